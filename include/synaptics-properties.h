@@ -130,9 +130,16 @@
 /* 32 bit, 2 values, width, z */
 #define SYNAPTICS_PROP_PALM_DIMENSIONS "Synaptics Palm Dimensions"
 
+/* FLOAT, 0 or 3 to MAX_ACCEL_PROFILE + 1 values (see synaptics.h),
+ * sample distance, speed factors. No values uses Synaptics Move Speed. */
+#define SYNAPTICS_PROP_ACCEL_PROFILE "Synaptics Acceleration Profile"
+
 /* FLOAT */
 #define SYNAPTICS_PROP_COASTING_SPEED "Synaptics Coasting Speed"
 
+/* FLOAT, scroll events per second per second */
+#define SYNAPTICS_PROP_COASTING_FRICTION "Synaptics Coasting Friction"
+
 /* 32 bit, 2 values, min, max */
 #define SYNAPTICS_PROP_PRESSURE_MOTION "Synaptics Pressure Motion"
 
@@ -155,4 +162,16 @@
 /* 32 bit, 4 values, left, right, top, bottom */
 #define SYNAPTICS_PROP_AREA "Synaptics Area"
 
+/* 32 bit, number of packets used for the finger velocity, 2 to 16 */
+#define SYNAPTICS_PROP_VELOCITY_SAMPLES "Synaptics Velocity Samples"
+
+/* 8 bit (BOOL) */
+#define SYNAPTICS_PROP_SMOOTH_SCROLLING "Synaptics Smooth Scrolling"
+
+/* 32 bit, write-only, any number of (property, index, value) triples.
+ * Changes several of the properties above at once. The whole set is
+ * validated first and then applied between two packets, or rejected.
+ * Values of FLOAT properties are passed as the bits of the float. */
+#define SYNAPTICS_PROP_PARAMETER_SET "Synaptics Parameter Set"
+
 #endif /* _SYNAPTICS_PROPERTIES_H_ */
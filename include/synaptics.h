@@ -47,13 +47,82 @@ typedef enum {
 } ClickFingerEvent;
 
 #define SYN_MAX_BUTTONS 12		    /* Max number of mouse buttons */
+#define MAX_ACCEL_PROFILE 32		    /* Max number of acceleration profile samples */
+#define MIN_ACCEL_PROFILE_STEP 0.1	    /* Smallest distance between two samples */
+#define SYN_SCROLL_INCREMENT 120	    /* Scroll valuator units per scroll step */
 
+/*
+ * Every device has its own shared memory area. Its key is derived from the
+ * device node with ftok(3), or SHM_SYNAPTICS_DEVICE if that fails. If an
+ * area with that key was created by an X server that still runs, the
+ * following keys are tried, so the key of a device can't be predicted.
+ * The area at SHM_SYNAPTICS is an index of the devices, so that tools can
+ * find them.
+ */
 #define SHM_SYNAPTICS 23947
-typedef struct _SynapticsSHM
+#define SHM_SYNAPTICS_DEVICE (SHM_SYNAPTICS + 1)
+#define SHM_FTOK_ID 'S'
+
+#define SYNSHM_INDEX_SIZE 16		    /* Max number of devices */
+#define SYNSHM_NAME_LEN 64
+
+typedef struct _SynapticsSHMIndexEntry
 {
-    int version;			    /* Driver version */
+    volatile int key;			    /* Shared memory key, 0 if unused */
+    int pid;				    /* X server owning the entry */
+    char name[SYNSHM_NAME_LEN];		    /* Input device name */
+} SynapticsSHMIndexEntry;
 
-    /* Current device state */
+typedef struct _SynapticsSHMIndex
+{
+    SynapticsSHMIndexEntry devices[SYNSHM_INDEX_SIZE];
+} SynapticsSHMIndex;
+
+/*
+ * The driver appends every hardware state it processes to a ring in the
+ * shared memory area, so that monitoring tools see all of them, not just
+ * the latest one.
+ *
+ * Each entry carries a sequence number. While the driver writes entry n
+ * (counting from 0 since the ring was created), its seq is 2n+1; once the
+ * entry is complete, it is 2n+2. write_index is the number of complete
+ * entries. To read entry n, a reader loads seq, copies the entry and
+ * loads seq again. The copy is valid if both loads returned 2n+2; a
+ * larger value means the entry was already overwritten because the reader
+ * fell more than SYNSHM_RING_SIZE entries behind. The driver never waits
+ * for readers.
+ *
+ * Where futexes are available, a reader does not need to poll: it sleeps
+ * in FUTEX_WAIT on write_index. While anybody has the area attached, the
+ * driver wakes all sleepers after advancing write_index. A reader with
+ * write access also sets waiting before it sleeps, so that the driver
+ * notices it right away; the driver clears it on the next wakeup. A
+ * read-only reader is only noticed through the attach count, which the
+ * driver checks once per second, and should sleep with a timeout.
+ */
+#define SYNSHM_RING_SIZE 256		    /* Must be a power of two */
+
+#if defined(__i386__) || defined(__x86_64__)
+/* Stores are not reordered with other stores, nor loads with loads */
+#define SYNSHM_BARRIER() __asm__ __volatile__("" ::: "memory")
+#elif defined(__GNUC__)
+#define SYNSHM_BARRIER() __sync_synchronize()
+#else
+/* Best effort, only seq and write_index are volatile */
+#define SYNSHM_BARRIER() do { } while (0)
+#endif
+
+/* Also orders earlier stores against later loads */
+#if defined(__GNUC__)
+#define SYNSHM_FULL_BARRIER() __sync_synchronize()
+#else
+#define SYNSHM_FULL_BARRIER() SYNSHM_BARRIER()
+#endif
+
+typedef struct _SynapticsSHMState
+{
+    volatile unsigned int seq;		    /* See above */
+    unsigned int millis;		    /* Timestamp of the state */
     int x, y;				    /* actual x, y coordinates */
     int z;				    /* pressure value */
     int numFingers;			    /* number of fingers */
@@ -63,6 +132,16 @@ typedef struct _SynapticsSHM
     Bool middle;
     int guest_left, guest_mid, guest_right; /* guest device buttons */
     int guest_dx, guest_dy; 		    /* guest device movement */
+} SynapticsSHMState;
+
+typedef struct _SynapticsSHM
+{
+    int version;			    /* Driver version */
+
+    /* Recent device states */
+    volatile unsigned int write_index;	    /* Number of states written */
+    volatile int waiting;		    /* A reader sleeps on write_index */
+    SynapticsSHMState ring[SYNSHM_RING_SIZE];
 } SynapticsSHM;
 
 /*
@@ -39,6 +39,11 @@
 #include "synapticsstr.h"
 #include <xf86.h>
 
+struct alps_proto_data {
+    Bool async;				/* initialize asynchronously */
+    struct PS2AsyncQueue queue;
+};
+
 
 /* Wait for the channel to go silent, which means we're in sync */
 static void
@@ -86,10 +91,98 @@ ALPS_initialize(int fd)
     ALPS_sync(fd);
 }
 
+/* The same sequence as ALPS_initialize(), sent through the async queue */
+static const byte alps_init_cmds[] = {
+    PS2_CMD_SET_DEFAULT,
+    PS2_CMD_SET_SCALING_2_1,
+    PS2_CMD_SET_SCALING_2_1,
+    PS2_CMD_SET_SCALING_2_1,
+    PS2_CMD_DISABLE,
+
+    PS2_CMD_DISABLE,
+    PS2_CMD_DISABLE,
+    PS2_CMD_DISABLE,
+    PS2_CMD_DISABLE,
+    PS2_CMD_ENABLE,
+
+    PS2_CMD_SET_SCALING_1_1,
+    PS2_CMD_SET_SCALING_1_1,
+    PS2_CMD_SET_SCALING_1_1,
+    PS2_CMD_DISABLE,
+
+    PS2_CMD_DISABLE,
+    PS2_CMD_DISABLE,
+    PS2_CMD_DISABLE,
+    PS2_CMD_DISABLE,
+    PS2_CMD_ENABLE
+};
+
+static void
+ALPS_initialize_done(LocalDevicePtr local, Bool success)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+
+    priv->comm.protoBufTail = 0;
+    if (success)
+	DBG(3, "%s: ALPS initialization done\n", local->name);
+    else
+	xf86Msg(X_WARNING, "%s: ALPS initialization failed\n", local->name);
+}
+
+static void
+ALPS_initialize_async(struct PS2AsyncQueue *q)
+{
+    int i;
+
+    ps2_async_clear(q);
+    for (i = 0; i < sizeof(alps_init_cmds) / sizeof(alps_init_cmds[0]); i++)
+	ps2_async_add(q, alps_init_cmds[i], 0, 100);
+    ps2_async_add_drain(q, 250);
+    ps2_async_start(q, ALPS_initialize_done);
+}
+
+static void
+ALPSDeviceOnHook(LocalDevicePtr local, SynapticsParameters *para)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct alps_proto_data *proto_data;
+
+    if (!priv->proto_data)
+        priv->proto_data = xcalloc(1, sizeof(struct alps_proto_data));
+    proto_data = (struct alps_proto_data*)priv->proto_data;
+    if (!proto_data)
+	return;
+
+    proto_data->async = ps2_async_init(&proto_data->queue, local);
+}
+
+static void
+ALPSDeviceOffHook(LocalDevicePtr local)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct alps_proto_data *proto_data = priv->proto_data;
+
+    if (proto_data) {
+	ps2_async_fini(&proto_data->queue);
+	proto_data->async = FALSE;
+    }
+}
+
+/*
+ * When the device is enabled, the init sequence runs in the background
+ * and the touchpad comes up once it is done. PreInit has no DeviceOnHook
+ * call, so the sequence is still sent synchronously there.
+ */
 static Bool
 ALPSQueryHardware(LocalDevicePtr local)
 {
-    ALPS_initialize(local->fd);
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct alps_proto_data *proto_data = priv->proto_data;
+
+    if (proto_data && proto_data->async)
+	ALPS_initialize_async(&proto_data->queue);
+    else
+	ALPS_initialize(local->fd);
     return TRUE;
 }
 
@@ -105,11 +198,18 @@ ALPS_packet_ok(struct CommData *comm)
 static Bool
 ALPS_get_packet(struct CommData *comm, LocalDevicePtr local)
 {
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct alps_proto_data *proto_data = priv->proto_data;
     int c;
 
     while ((c = XisbRead(comm->buffer)) >= 0) {
 	unsigned char u = (unsigned char)c;
 
+	/* replies to the init sequence */
+	if (proto_data && proto_data->async &&
+	    ps2_async_input(&proto_data->queue, u))
+	    continue;
+
 	comm->protoBuf[comm->protoBufTail++] = u;
 
 	if (comm->protoBufTail == 3) { /* PS/2 packet received? */
@@ -238,6 +338,7 @@ ALPSReadHwState(LocalDevicePtr local,
 	return FALSE;
 
     ALPS_process_packet(buf, hw);
+    hw->millis = GetTimeInMillis();
 
     *hwRet = *hw;
     return TRUE;
@@ -250,8 +351,8 @@ ALPSAutoDevProbe(LocalDevicePtr local)
 }
 
 struct SynapticsProtocolOperations alps_proto_operations = {
-    NULL,
-    NULL,
+    ALPSDeviceOnHook,
+    ALPSDeviceOffHook,
     ALPSQueryHardware,
     ALPSReadHwState,
     ALPSAutoDevProbe,
@@ -37,6 +37,7 @@
 #include <dirent.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #include "synproto.h"
 #include "synaptics.h"
 #include "synapticsstr.h"
@@ -49,22 +50,87 @@
 #define NBITS(x) (((x) + LONG_BITS - 1) / LONG_BITS)
 #define OFF(x)   ((x) % LONG_BITS)
 #define LONG(x)  ((x) / LONG_BITS)
-#define TEST_BIT(bit, array) (array[LONG(bit)] & (1 << OFF(bit)))
+#define TEST_BIT(bit, array) (array[LONG(bit)] & (1UL << OFF(bit)))
+
+/* Number of input_events pulled from the kernel with a single read() */
+#define EVENT_BUFFER_SIZE 64
+
+struct eventcomm_proto_data
+{
+    BOOL need_grab;
+
+    /* Events read from the device but not yet processed. A SYN_REPORT
+     * frame may be split across two reads, the remainder is kept here
+     * until the next ReadInput call. */
+    struct input_event ev_buf[EVENT_BUFFER_SIZE];
+    int ev_head;			/* Index of the next unprocessed event */
+    int ev_count;			/* Number of valid events in ev_buf */
+
+    Bool syn_dropped;			/* Kernel buffer overflowed, waiting
+					   for the end of the broken frame */
+    Bool use_ev_time;			/* Event timestamps are in the server's
+					   time base, see event_set_clock() */
+};
 
 /*****************************************************************************
  *	Function Definitions
  ****************************************************************************/
 
+/*
+ * Ask the kernel to timestamp events with CLOCK_MONOTONIC. The event
+ * timestamps are only usable if they are in the same time base as
+ * GetTimeInMillis(), which is what the timers and tap timeouts run on. The
+ * server uses the monotonic clock where available, but check that the two
+ * actually agree before relying on it.
+ */
+static Bool
+event_set_clock(LocalDevicePtr local)
+{
+#ifdef CLOCK_MONOTONIC
+    int clk = CLOCK_MONOTONIC;
+    struct timespec ts;
+    CARD32 mono, now;
+    int rc;
+
+    SYSCALL(rc = ioctl(local->fd, EVIOCSCLOCKID, &clk));
+    if (rc < 0)
+	return FALSE;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+	return FALSE;
+    mono = (CARD32)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    now = GetTimeInMillis();
+
+    return abs((int)(now - mono)) < 1000;
+#else
+    return FALSE;
+#endif
+}
+
+static void
+event_reset_slots(struct CommData *comm)
+{
+    int i;
+
+    for (i = 0; i < SYNAPTICS_MAX_TOUCHES; i++)
+	comm->slots[i].trackingId = -1;
+    comm->curSlot = 0;
+}
+
 static void
 EventDeviceOnHook(LocalDevicePtr local, SynapticsParameters *para)
 {
     SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
-    BOOL *need_grab;
+    struct eventcomm_proto_data *proto_data;
 
     if (!priv->proto_data)
-        priv->proto_data = xcalloc(1, sizeof(BOOL));
+        priv->proto_data = xcalloc(1, sizeof(struct eventcomm_proto_data));
+
+    proto_data = (struct eventcomm_proto_data*)priv->proto_data;
+    proto_data->ev_head = proto_data->ev_count = 0;
+    proto_data->syn_dropped = FALSE;
 
-    need_grab = (BOOL*)priv->proto_data;
+    event_reset_slots(&priv->comm);
 
     if (para->grab_event_device) {
 	/* Try to grab the event device so that data don't leak to /dev/input/mice */
@@ -76,7 +142,12 @@ EventDeviceOnHook(LocalDevicePtr local, SynapticsParameters *para)
 	}
     }
 
-    *need_grab = FALSE;
+    proto_data->need_grab = FALSE;
+
+    proto_data->use_ev_time = event_set_clock(local);
+    if (!proto_data->use_ev_time)
+	xf86Msg(X_INFO, "%s: kernel event timestamps not usable, using server time\n",
+		local->name);
 }
 
 static Bool
@@ -206,10 +277,17 @@ event_query_axis_ranges(LocalDevicePtr local)
 		strerror(errno));
 
     priv->has_pressure = FALSE;
+    priv->has_mt = FALSE;
     SYSCALL(rc = ioctl(local->fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits));
-    if (rc >= 0)
+    if (rc >= 0) {
 	priv->has_pressure = TEST_BIT(ABS_PRESSURE, absbits);
-    else
+	priv->has_mt = TEST_BIT(ABS_MT_SLOT, absbits) &&
+		       TEST_BIT(ABS_MT_POSITION_X, absbits) &&
+		       TEST_BIT(ABS_MT_POSITION_Y, absbits);
+	if (priv->has_mt)
+	    xf86Msg(X_INFO, "%s: device reports multitouch slots\n",
+		    local->name);
+    } else
 	xf86Msg(X_ERROR, "%s: failed to query ABS bits (%s)\n", local->name,
 		strerror(errno));
 
@@ -259,9 +337,9 @@ static Bool
 EventQueryHardware(LocalDevicePtr local)
 {
     SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
-    BOOL *need_grab = (BOOL*)priv->proto_data;
+    struct eventcomm_proto_data *proto_data = priv->proto_data;
 
-    if (!event_query_is_touchpad(local->fd, (need_grab) ? *need_grab : TRUE))
+    if (!event_query_is_touchpad(local->fd, (proto_data) ? proto_data->need_grab : TRUE))
 	return FALSE;
 
     xf86Msg(X_PROBED, "%s: touchpad found\n", local->name);
@@ -269,24 +347,252 @@ EventQueryHardware(LocalDevicePtr local)
     return TRUE;
 }
 
+/*
+ * Return the next event from the device. Events are read from the kernel
+ * in batches of up to EVENT_BUFFER_SIZE, so a full SYN_REPORT frame
+ * usually costs a single read() syscall instead of one per event.
+ */
 static Bool
 SynapticsReadEvent(LocalDevicePtr local, struct input_event *ev)
 {
-    int rc = TRUE;
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct eventcomm_proto_data *proto_data = priv->proto_data;
     ssize_t len;
 
-    len = read(local->fd, ev, sizeof(*ev));
-    if (len <= 0)
-    {
-        /* We use X_NONE here because it doesn't alloc */
-        if (errno != EAGAIN)
-            xf86MsgVerb(X_NONE, 0, "%s: Read error %s\n", local->name, strerror(errno));
-        rc = FALSE;
-    } else if (len % sizeof(*ev)) {
-        xf86MsgVerb(X_NONE, 0, "%s: Read error, invalid number of bytes.", local->name);
-        rc = FALSE;
+    if (proto_data->ev_head >= proto_data->ev_count) {
+	proto_data->ev_head = proto_data->ev_count = 0;
+
+	len = read(local->fd, proto_data->ev_buf, sizeof(proto_data->ev_buf));
+	if (len <= 0)
+	{
+	    /* We use X_NONE here because it doesn't alloc */
+	    if (errno != EAGAIN)
+		xf86MsgVerb(X_NONE, 0, "%s: Read error %s\n", local->name, strerror(errno));
+	    return FALSE;
+	} else if (len % sizeof(*ev)) {
+	    xf86MsgVerb(X_NONE, 0, "%s: Read error, invalid number of bytes.", local->name);
+	    return FALSE;
+	}
+	proto_data->ev_count = len / sizeof(*ev);
+    }
+
+    *ev = proto_data->ev_buf[proto_data->ev_head++];
+    return TRUE;
+}
+
+static void
+event_process_key(SynapticsPrivate *priv, struct CommData *comm,
+		  int code, Bool v)
+{
+    struct SynapticsHwState *hw = &(comm->hwState);
+
+    switch (code) {
+    case BTN_LEFT:
+	hw->left = v;
+	break;
+    case BTN_RIGHT:
+	hw->right = v;
+	break;
+    case BTN_MIDDLE:
+	hw->middle = v;
+	break;
+    case BTN_FORWARD:
+	hw->up = v;
+	break;
+    case BTN_BACK:
+	hw->down = v;
+	break;
+    case BTN_0:
+	hw->multi[0] = v;
+	break;
+    case BTN_1:
+	hw->multi[1] = v;
+	break;
+    case BTN_2:
+	hw->multi[2] = v;
+	break;
+    case BTN_3:
+	hw->multi[3] = v;
+	break;
+    case BTN_4:
+	hw->multi[4] = v;
+	break;
+    case BTN_5:
+	hw->multi[5] = v;
+	break;
+    case BTN_6:
+	hw->multi[6] = v;
+	break;
+    case BTN_7:
+	hw->multi[7] = v;
+	break;
+    case BTN_TOOL_FINGER:
+	comm->oneFinger = v;
+	break;
+    case BTN_TOOL_DOUBLETAP:
+	comm->twoFingers = v;
+	break;
+    case BTN_TOOL_TRIPLETAP:
+	comm->threeFingers = v;
+	break;
+    case BTN_A:
+	hw->guest_left = v;
+	break;
+    case BTN_B:
+	hw->guest_right = v;
+	break;
+    case BTN_TOUCH:
+	if (!priv->has_pressure)
+		hw->z = v ? priv->synpara.finger_high + 1 : 0;
+	break;
     }
-    return rc;
+}
+
+static void
+event_process_abs(struct CommData *comm, int code, int value)
+{
+    struct SynapticsHwState *hw = &(comm->hwState);
+    struct SynapticsSlot *slot = NULL;
+
+    if (comm->curSlot >= 0 && comm->curSlot < SYNAPTICS_MAX_TOUCHES)
+	slot = &comm->slots[comm->curSlot];
+
+    switch (code) {
+    case ABS_X:
+	hw->x = value;
+	break;
+    case ABS_Y:
+	hw->y = value;
+	break;
+    case ABS_PRESSURE:
+	hw->z = value;
+	break;
+    case ABS_TOOL_WIDTH:
+	hw->fingerWidth = value;
+	break;
+    case ABS_MT_SLOT:
+	comm->curSlot = value;
+	break;
+    /* Contacts in slots beyond SYNAPTICS_MAX_TOUCHES are ignored */
+    case ABS_MT_TRACKING_ID:
+	if (slot)
+	    slot->trackingId = value;
+	break;
+    case ABS_MT_POSITION_X:
+	if (slot)
+	    slot->x = value;
+	break;
+    case ABS_MT_POSITION_Y:
+	if (slot)
+	    slot->y = value;
+	break;
+    case ABS_MT_PRESSURE:
+	if (slot)
+	    slot->z = value;
+	break;
+    }
+}
+
+/*
+ * Copy the active slots into the compact touch list of the hardware
+ * state, in slot order.
+ */
+static void
+event_collect_touches(struct CommData *comm)
+{
+    struct SynapticsHwState *hw = &(comm->hwState);
+    int i, n = 0;
+
+    for (i = 0; i < SYNAPTICS_MAX_TOUCHES; i++) {
+	const struct SynapticsSlot *slot = &comm->slots[i];
+	if (slot->trackingId < 0)
+	    continue;
+	hw->touches[n].x = slot->x;
+	hw->touches[n].y = slot->y;
+	hw->touches[n].z = slot->z;
+	n++;
+    }
+    hw->numTouches = n;
+}
+
+/* Keys and axes that make up the accumulated hardware state. */
+static const int resync_keys[] = {
+    BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, BTN_FORWARD, BTN_BACK,
+    BTN_0, BTN_1, BTN_2, BTN_3, BTN_4, BTN_5, BTN_6, BTN_7,
+    BTN_TOOL_FINGER, BTN_TOOL_DOUBLETAP, BTN_TOOL_TRIPLETAP,
+    BTN_A, BTN_B, BTN_TOUCH
+};
+
+static const int resync_axes[] = {
+    ABS_X, ABS_Y, ABS_PRESSURE, ABS_TOOL_WIDTH
+};
+
+static const int resync_mt_axes[] = {
+    ABS_MT_TRACKING_ID, ABS_MT_POSITION_X, ABS_MT_POSITION_Y, ABS_MT_PRESSURE
+};
+
+/* Re-read all slots with one EVIOCGMTSLOTS per axis. */
+static void
+event_resync_slots(LocalDevicePtr local, struct CommData *comm)
+{
+    struct {
+	__u32 code;
+	__s32 values[SYNAPTICS_MAX_TOUCHES];
+    } req;
+    struct input_absinfo abs;
+    int i, j, rc;
+
+    for (i = 0; i < sizeof(resync_mt_axes) / sizeof(resync_mt_axes[0]); i++) {
+	req.code = resync_mt_axes[i];
+	SYSCALL(rc = ioctl(local->fd, EVIOCGMTSLOTS(sizeof(req)), &req));
+	if (rc < 0)
+	    continue;
+	for (j = 0; j < SYNAPTICS_MAX_TOUCHES; j++) {
+	    comm->curSlot = j;
+	    event_process_abs(comm, resync_mt_axes[i], req.values[j]);
+	}
+    }
+
+    SYSCALL(rc = ioctl(local->fd, EVIOCGABS(ABS_MT_SLOT), &abs));
+    comm->curSlot = (rc >= 0) ? abs.value : 0;
+}
+
+/*
+ * Re-read the complete device state after the kernel dropped events
+ * (SYN_DROPPED). The key state is fetched with a single EVIOCGKEY, the
+ * axes with one EVIOCGABS each. Relative guest motion is lost and
+ * reset to zero.
+ */
+static void
+event_resync_state(LocalDevicePtr local, struct CommData *comm)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct SynapticsHwState *hw = &(comm->hwState);
+    unsigned long keybits[NBITS(KEY_MAX)] = {0};
+    struct input_absinfo abs;
+    int i, rc;
+
+    SYSCALL(rc = ioctl(local->fd, EVIOCGKEY(sizeof(keybits)), keybits));
+    if (rc >= 0) {
+	for (i = 0; i < sizeof(resync_keys) / sizeof(resync_keys[0]); i++)
+	    event_process_key(priv, comm, resync_keys[i],
+			      TEST_BIT(resync_keys[i], keybits) ? TRUE : FALSE);
+    } else
+	xf86MsgVerb(X_NONE, 0, "%s: failed to resync key state (%s)\n",
+		    local->name, strerror(errno));
+
+    for (i = 0; i < sizeof(resync_axes) / sizeof(resync_axes[0]); i++) {
+	if (resync_axes[i] == ABS_PRESSURE && !priv->has_pressure)
+	    continue;
+	SYSCALL(rc = ioctl(local->fd, EVIOCGABS(resync_axes[i]), &abs));
+	if (rc >= 0)
+	    event_process_abs(comm, resync_axes[i], abs.value);
+    }
+
+    if (priv->has_mt)
+	event_resync_slots(local, comm);
+
+    hw->guest_dx = hw->guest_dy = 0;
 }
 
 static Bool
@@ -295,16 +601,33 @@ EventReadHwState(LocalDevicePtr local,
 		 struct CommData *comm, struct SynapticsHwState *hwRet)
 {
     struct input_event ev;
-    Bool v;
     struct SynapticsHwState *hw = &(comm->hwState);
     SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
-    SynapticsParameters *para = &priv->synpara;
+    struct eventcomm_proto_data *proto_data = priv->proto_data;
 
     while (SynapticsReadEvent(local, &ev)) {
+	/* After a SYN_DROPPED, everything up to and including the next
+	 * SYN_REPORT belongs to an incomplete frame and is discarded. */
+	if (proto_data->syn_dropped &&
+	    !(ev.type == EV_SYN && ev.code == SYN_REPORT))
+	    continue;
+
 	switch (ev.type) {
 	case EV_SYN:
 	    switch (ev.code) {
+	    case SYN_DROPPED:
+		DBG(3, "%s: SYN_DROPPED, resyncing\n", local->name);
+		proto_data->syn_dropped = TRUE;
+		break;
 	    case SYN_REPORT:
+		if (proto_data->syn_dropped) {
+		    proto_data->syn_dropped = FALSE;
+		    event_resync_state(local, comm);
+		}
+		if (proto_data->use_ev_time)
+		    hw->millis = (CARD32)ev.time.tv_sec * 1000 + ev.time.tv_usec / 1000;
+		else
+		    hw->millis = GetTimeInMillis();
 		if (comm->oneFinger)
 		    hw->numFingers = 1;
 		else if (comm->twoFingers)
@@ -313,88 +636,21 @@ EventReadHwState(LocalDevicePtr local,
 		    hw->numFingers = 3;
 		else
 		    hw->numFingers = 0;
+		if (priv->has_mt) {
+		    event_collect_touches(comm);
+		    if (hw->numTouches > hw->numFingers)
+			hw->numFingers = hw->numTouches;
+		}
 		*hwRet = *hw;
 		hw->guest_dx = hw->guest_dy = 0;
 		return TRUE;
 	    }
+	    break;
 	case EV_KEY:
-	    v = (ev.value ? TRUE : FALSE);
-	    switch (ev.code) {
-	    case BTN_LEFT:
-		hw->left = v;
-		break;
-	    case BTN_RIGHT:
-		hw->right = v;
-		break;
-	    case BTN_MIDDLE:
-		hw->middle = v;
-		break;
-	    case BTN_FORWARD:
-		hw->up = v;
-		break;
-	    case BTN_BACK:
-		hw->down = v;
-		break;
-	    case BTN_0:
-		hw->multi[0] = v;
-		break;
-	    case BTN_1:
-		hw->multi[1] = v;
-		break;
-	    case BTN_2:
-		hw->multi[2] = v;
-		break;
-	    case BTN_3:
-		hw->multi[3] = v;
-		break;
-	    case BTN_4:
-		hw->multi[4] = v;
-		break;
-	    case BTN_5:
-		hw->multi[5] = v;
-		break;
-	    case BTN_6:
-		hw->multi[6] = v;
-		break;
-	    case BTN_7:
-		hw->multi[7] = v;
-		break;
-	    case BTN_TOOL_FINGER:
-		comm->oneFinger = v;
-		break;
-	    case BTN_TOOL_DOUBLETAP:
-		comm->twoFingers = v;
-		break;
-	    case BTN_TOOL_TRIPLETAP:
-		comm->threeFingers = v;
-		break;
-	    case BTN_A:
-		hw->guest_left = v;
-		break;
-	    case BTN_B:
-		hw->guest_right = v;
-		break;
-	    case BTN_TOUCH:
-		if (!priv->has_pressure)
-			hw->z = v ? para->finger_high + 1 : 0;
-		break;
-	    }
+	    event_process_key(priv, comm, ev.code, ev.value ? TRUE : FALSE);
 	    break;
 	case EV_ABS:
-	    switch (ev.code) {
-	    case ABS_X:
-		hw->x = ev.value;
-		break;
-	    case ABS_Y:
-		hw->y = ev.value;
-		break;
-	    case ABS_PRESSURE:
-		hw->z = ev.value;
-		break;
-	    case ABS_TOOL_WIDTH:
-		hw->fingerWidth = ev.value;
-		break;
-	    }
+	    event_process_abs(comm, ev.code, ev.value);
 	    break;
 	case EV_REL:
 	    switch (ev.code) {
@@ -423,9 +679,9 @@ static void
 EventReadDevDimensions(LocalDevicePtr local)
 {
     SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
-    BOOL *need_grab = (BOOL*)priv->proto_data;
+    struct eventcomm_proto_data *proto_data = priv->proto_data;
 
-    if (event_query_is_touchpad(local->fd, (need_grab) ? *need_grab : TRUE))
+    if (event_query_is_touchpad(local->fd, (proto_data) ? proto_data->need_grab : TRUE))
 	event_query_axis_ranges(local);
     event_query_info(local);
 }
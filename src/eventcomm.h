@@ -34,4 +34,32 @@
 #define DEV_INPUT_EVENT "/dev/input"
 #define EVENT_DEV_NAME "event"
 
+/* Not defined in kernel headers before 2.6.39 */
+#ifndef SYN_DROPPED
+#define SYN_DROPPED 3
+#endif
+
+/* Multitouch protocol B, not defined in kernel headers before 2.6.36 */
+#ifndef ABS_MT_SLOT
+#define ABS_MT_SLOT		0x2f
+#endif
+#ifndef ABS_MT_POSITION_X
+#define ABS_MT_POSITION_X	0x35
+#define ABS_MT_POSITION_Y	0x36
+#endif
+#ifndef ABS_MT_TRACKING_ID
+#define ABS_MT_TRACKING_ID	0x39
+#endif
+#ifndef ABS_MT_PRESSURE
+#define ABS_MT_PRESSURE		0x3a
+#endif
+#ifndef EVIOCGMTSLOTS
+#define EVIOCGMTSLOTS(len)	_IOC(_IOC_READ, 'E', 0x0a, len)
+#endif
+
+/* Not defined in kernel headers before 3.4 */
+#ifndef EVIOCSCLOCKID
+#define EVIOCSCLOCKID _IOW('E', 0xa0, int)
+#endif
+
 #endif /* _EVENTCOMM_H_ */
@@ -31,6 +31,8 @@
 #include "xf86Module.h"
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 3
 
+#include <stddef.h>
+#include <math.h>
 #include <X11/Xatom.h>
 #include <xf86.h>
 #include <xf86Xinput.h>
@@ -58,6 +60,7 @@ Atom prop_scrolldist            = 0;
 Atom prop_scrolledge            = 0;
 Atom prop_scrolltwofinger       = 0;
 Atom prop_speed                 = 0;
+Atom prop_accel_profile         = 0;
 Atom prop_edgemotion_pressure   = 0;
 Atom prop_edgemotion_speed      = 0;
 Atom prop_edgemotion_always     = 0;
@@ -77,6 +80,7 @@ Atom prop_circpad               = 0;
 Atom prop_palm                  = 0;
 Atom prop_palm_dim              = 0;
 Atom prop_coastspeed            = 0;
+Atom prop_coastfriction         = 0;
 Atom prop_pressuremotion        = 0;
 Atom prop_pressuremotion_factor = 0;
 Atom prop_grab                  = 0;
@@ -84,6 +88,11 @@ Atom prop_gestures              = 0;
 Atom prop_capabilities          = 0;
 Atom prop_resolution            = 0;
 Atom prop_area                  = 0;
+Atom prop_smooth_scrolling      = 0;
+Atom prop_velocity_samples      = 0;
+Atom prop_parameter_set         = 0;
+
+static void InitPropertyHandlers(void);
 
 static Atom
 InitAtom(DeviceIntPtr dev, char *name, int format, int nvalues, int *values)
@@ -140,6 +149,8 @@ InitDeviceProperties(LocalDevicePtr local)
     SynapticsParameters *para = &priv->synpara;
     int values[9]; /* we never have more than 9 values in an atom */
     float fvalues[4]; /* never have more than 4 float values */
+    float fprofile[MAX_ACCEL_PROFILE + 1]; /* except for the acceleration profile */
+    int i;
 
     float_type = XIGetKnownProperty(XATOM_FLOAT);
     if (!float_type)
@@ -199,6 +210,17 @@ InitDeviceProperties(LocalDevicePtr local)
     fvalues[3] = para->trackstick_speed;
     prop_speed = InitFloatAtom(local->dev, SYNAPTICS_PROP_SPEED, 4, fvalues);
 
+    if (para->accel_profile_len > 0)
+    {
+        fprofile[0] = para->accel_profile_step;
+        for (i = 0; i < para->accel_profile_len; i++)
+            fprofile[i + 1] = para->accel_profile[i];
+        prop_accel_profile = InitFloatAtom(local->dev, SYNAPTICS_PROP_ACCEL_PROFILE,
+                                           para->accel_profile_len + 1, fprofile);
+    } else
+        prop_accel_profile = InitFloatAtom(local->dev, SYNAPTICS_PROP_ACCEL_PROFILE,
+                                           0, fprofile);
+
     values[0] = para->edge_motion_min_z;
     values[1] = para->edge_motion_max_z;
     prop_edgemotion_pressure = InitAtom(local->dev, SYNAPTICS_PROP_EDGEMOTION_PRESSURE, 32, 2, values);
@@ -244,6 +266,9 @@ InitDeviceProperties(LocalDevicePtr local)
     fvalues[0] = para->coasting_speed;
     prop_coastspeed = InitFloatAtom(local->dev, SYNAPTICS_PROP_COASTING_SPEED, 1, fvalues);
 
+    fvalues[0] = para->coasting_friction;
+    prop_coastfriction = InitFloatAtom(local->dev, SYNAPTICS_PROP_COASTING_FRICTION, 1, fvalues);
+
     values[0] = para->press_motion_min_z;
     values[1] = para->press_motion_max_z;
     prop_pressuremotion = InitAtom(local->dev, SYNAPTICS_PROP_PRESSURE_MOTION, 32, 2, values);
@@ -274,378 +299,622 @@ InitDeviceProperties(LocalDevicePtr local)
     values[2] = para->area_top_edge;
     values[3] = para->area_bottom_edge;
     prop_area = InitAtom(local->dev, SYNAPTICS_PROP_AREA, 32, 4, values);
+
+    prop_smooth_scrolling = InitAtom(local->dev, SYNAPTICS_PROP_SMOOTH_SCROLLING, 8, 1, &para->smooth_scrolling);
+
+    prop_velocity_samples = InitAtom(local->dev, SYNAPTICS_PROP_VELOCITY_SAMPLES, 32, 1, &para->velocity_samples);
+
+    prop_parameter_set = InitAtom(local->dev, SYNAPTICS_PROP_PARAMETER_SET, 32, 0, values);
+
+    InitPropertyHandlers();
 }
 
-int
-SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
-            BOOL checkonly)
+/*
+ * SetProperty dispatch.
+ *
+ * Every property the driver accepts has an entry in prop_handlers, with the
+ * format, number and type of values it expects and the function that stores
+ * them in the parameters. The simple properties, a single value stored in a
+ * single parameter, share the generic setters and only give the offset of
+ * that parameter. The atoms are looked up in a small hash table that is
+ * built by InitDeviceProperties once the atoms exist.
+ */
+
+struct _PropertyHandler;
+
+typedef int (*PropertySetFunc)(SynapticsParameters *para,
+                               XIPropertyValuePtr prop,
+                               const struct _PropertyHandler *handler);
+
+#define PROP_FLOAT      (1 << 0)    /* values are of type FLOAT, not INTEGER */
+#define PROP_MAX_SIZE   (1 << 1)    /* size is the maximum number of values */
+#define PROP_READONLY   (1 << 2)    /* can't be changed by clients */
+#define PROP_DERIVED    (1 << 3)    /* derived parameters depend on it */
+
+typedef struct _PropertyHandler {
+    Atom *atom;
+    int format;
+    int size;
+    int flags;
+    PropertySetFunc set;
+    size_t offset;                  /* parameter used by the generic setters */
+} PropertyHandler;
+
+#define PARAM(field)    offsetof(SynapticsParameters, field)
+#define PARAM_PTR(para, type, offset) ((type *)((char *)(para) + (offset)))
+
+static int
+set_int(SynapticsParameters *para, XIPropertyValuePtr prop,
+        const PropertyHandler *handler)
 {
-    LocalDevicePtr local = (LocalDevicePtr) dev->public.devicePrivate;
-    SynapticsPrivate *priv = (SynapticsPrivate *) local->private;
-    SynapticsParameters *para = &priv->synpara;
-    SynapticsParameters tmp;
+    *PARAM_PTR(para, int, handler->offset) = *(INT32*)prop->data;
+    return Success;
+}
 
-    /* If checkonly is set, no parameters may be changed. So just let the code
-     * change temporary variables and forget about it. */
-    if (checkonly)
-    {
-        tmp = *para;
-        para = &tmp;
-    }
+static int
+set_bool(SynapticsParameters *para, XIPropertyValuePtr prop,
+         const PropertyHandler *handler)
+{
+    *PARAM_PTR(para, Bool, handler->offset) = *(BOOL*)prop->data;
+    return Success;
+}
 
-    if (property == prop_edges)
-    {
-        INT32 *edges;
-        if (prop->size != 4 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_double(SynapticsParameters *para, XIPropertyValuePtr prop,
+           const PropertyHandler *handler)
+{
+    *PARAM_PTR(para, double, handler->offset) = *(float*)prop->data;
+    return Success;
+}
 
-        edges = (INT32*)prop->data;
-        if (edges[0] > edges[1] || edges[2] > edges[3])
-            return BadValue;
+static int
+set_edges(SynapticsParameters *para, XIPropertyValuePtr prop,
+          const PropertyHandler *handler)
+{
+    INT32 *edges = (INT32*)prop->data;
 
-        para->left_edge   = edges[0];
-        para->right_edge  = edges[1];
-        para->top_edge    = edges[2];
-        para->bottom_edge = edges[3];
+    if (edges[0] > edges[1] || edges[2] > edges[3])
+        return BadValue;
 
-    } else if (property == prop_finger)
-    {
-        INT32 *finger;
-        if (prop->size != 3 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+    para->left_edge   = edges[0];
+    para->right_edge  = edges[1];
+    para->top_edge    = edges[2];
+    para->bottom_edge = edges[3];
+    return Success;
+}
 
-        finger = (INT32*)prop->data;
-        if (finger[0] > finger[1])
-            return BadValue;
+static int
+set_finger(SynapticsParameters *para, XIPropertyValuePtr prop,
+           const PropertyHandler *handler)
+{
+    INT32 *finger = (INT32*)prop->data;
 
-        para->finger_low   = finger[0];
-        para->finger_high  = finger[1];
-        para->finger_press = finger[2];
+    if (finger[0] > finger[1])
+        return BadValue;
 
-    } else if (property == prop_tap_time)
-    {
-        if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+    para->finger_low   = finger[0];
+    para->finger_high  = finger[1];
+    para->finger_press = finger[2];
+    return Success;
+}
 
-        para->tap_time = *(INT32*)prop->data;
+static int
+set_tap_durations(SynapticsParameters *para, XIPropertyValuePtr prop,
+                  const PropertyHandler *handler)
+{
+    INT32 *timeouts = (INT32*)prop->data;
 
-    } else if (property == prop_tap_move)
-    {
-        if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+    para->single_tap_timeout = timeouts[0];
+    para->tap_time_2         = timeouts[1];
+    para->click_time         = timeouts[2];
+    return Success;
+}
 
-        para->tap_move = *(INT32*)prop->data;
-    } else if (property == prop_tap_durations)
-    {
-        INT32 *timeouts;
+static int
+set_scrolldist(SynapticsParameters *para, XIPropertyValuePtr prop,
+               const PropertyHandler *handler)
+{
+    INT32 *dist = (INT32*)prop->data;
 
-        if (prop->size != 3 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+    para->scroll_dist_vert  = dist[0];
+    para->scroll_dist_horiz = dist[1];
+    return Success;
+}
 
-        timeouts = (INT32*)prop->data;
+static int
+set_scrolledge(SynapticsParameters *para, XIPropertyValuePtr prop,
+               const PropertyHandler *handler)
+{
+    BOOL *edge = (BOOL*)prop->data;
 
-        para->single_tap_timeout = timeouts[0];
-        para->tap_time_2         = timeouts[1];
-        para->click_time         = timeouts[2];
+    para->scroll_edge_vert   = edge[0];
+    para->scroll_edge_horiz  = edge[1];
+    para->scroll_edge_corner = edge[2];
+    return Success;
+}
 
-    } else if (property == prop_tap_fast)
-    {
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_scrolltwofinger(SynapticsParameters *para, XIPropertyValuePtr prop,
+                    const PropertyHandler *handler)
+{
+    BOOL *twofinger = (BOOL*)prop->data;
 
-        para->fast_taps = *(BOOL*)prop->data;
+    para->scroll_twofinger_vert  = twofinger[0];
+    para->scroll_twofinger_horiz = twofinger[1];
+    return Success;
+}
 
-    } else if (property == prop_middle_timeout)
-    {
-        if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_speed(SynapticsParameters *para, XIPropertyValuePtr prop,
+          const PropertyHandler *handler)
+{
+    float *speed = (float*)prop->data;
 
-        para->emulate_mid_button_time = *(INT32*)prop->data;
-    } else if (property == prop_twofinger_pressure)
-    {
-        if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+    para->min_speed        = speed[0];
+    para->max_speed        = speed[1];
+    para->accl             = speed[2];
+    para->trackstick_speed = speed[3];
+    return Success;
+}
 
-        para->emulate_twofinger_z = *(INT32*)prop->data;
-    } else if (property == prop_twofinger_width)
-    {
-        if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_accel_profile(SynapticsParameters *para, XIPropertyValuePtr prop,
+                  const PropertyHandler *handler)
+{
+    float *profile = (float*)prop->data;
+    int i;
 
-        para->emulate_twofinger_w = *(INT32*)prop->data;
-    } else if (property == prop_scrolldist)
-    {
-        INT32 *dist;
-        if (prop->size != 2 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
-
-        dist = (INT32*)prop->data;
-        para->scroll_dist_vert = dist[0];
-        para->scroll_dist_horiz = dist[1];
-    } else if (property == prop_scrolledge)
+    if (prop->size == 0)
     {
-        CARD8 *edge;
-        if (prop->size != 3 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
-
-        edge = (BOOL*)prop->data;
-        para->scroll_edge_vert   = edge[0];
-        para->scroll_edge_horiz  = edge[1];
-        para->scroll_edge_corner = edge[2];
-    } else if (property == prop_scrolltwofinger)
-    {
-        CARD8 *twofinger;
+        para->accel_profile_len = 0;
+        return Success;
+    }
 
-        if (prop->size != 2 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+    if (prop->size < 3 || !isfinite(profile[0]) ||
+        profile[0] < MIN_ACCEL_PROFILE_STEP)
+        return BadValue;
+    for (i = 1; i < prop->size; i++)
+        if (!isfinite(profile[i]) || profile[i] < 0)
+            return BadValue;
 
-        twofinger = (BOOL*)prop->data;
-        para->scroll_twofinger_vert  = twofinger[0];
-        para->scroll_twofinger_horiz = twofinger[1];
-    } else if (property == prop_speed)
-    {
-        float *speed;
+    para->accel_profile_step = profile[0];
+    for (i = 1; i < prop->size; i++)
+        para->accel_profile[i - 1] = profile[i];
+    para->accel_profile_len = prop->size - 1;
+    return Success;
+}
 
-        if (prop->size != 4 || prop->format != 32 || prop->type != float_type)
-            return BadMatch;
+static int
+set_edgemotion_pressure(SynapticsParameters *para, XIPropertyValuePtr prop,
+                        const PropertyHandler *handler)
+{
+    CARD32 *pressure = (CARD32*)prop->data;
 
-        speed = (float*)prop->data;
-        para->min_speed = speed[0];
-        para->max_speed = speed[1];
-        para->accl = speed[2];
-        para->trackstick_speed = speed[3];
+    if (pressure[0] > pressure[1])
+        return BadValue;
 
-    } else if (property == prop_edgemotion_pressure)
-    {
-        CARD32 *pressure;
+    para->edge_motion_min_z = pressure[0];
+    para->edge_motion_max_z = pressure[1];
+    return Success;
+}
 
-        if (prop->size != 2 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_edgemotion_speed(SynapticsParameters *para, XIPropertyValuePtr prop,
+                     const PropertyHandler *handler)
+{
+    CARD32 *speed = (CARD32*)prop->data;
 
-        pressure = (CARD32*)prop->data;
-        if (pressure[0] > pressure[1])
-            return BadValue;
+    if (speed[0] > speed[1])
+        return BadValue;
 
-        para->edge_motion_min_z = pressure[0];
-        para->edge_motion_max_z = pressure[1];
+    para->edge_motion_min_speed = speed[0];
+    para->edge_motion_max_speed = speed[1];
+    return Success;
+}
 
-    } else if (property == prop_edgemotion_speed)
-    {
-        CARD32 *speed;
+static int
+set_buttonscroll(SynapticsParameters *para, XIPropertyValuePtr prop,
+                 const PropertyHandler *handler)
+{
+    BOOL *scroll = (BOOL*)prop->data;
 
-        if (prop->size != 2 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+    para->updown_button_scrolling    = scroll[0];
+    para->leftright_button_scrolling = scroll[1];
+    return Success;
+}
 
-        speed = (CARD32*)prop->data;
-        if (speed[0] > speed[1])
-            return BadValue;
+static int
+set_buttonscroll_repeat(SynapticsParameters *para, XIPropertyValuePtr prop,
+                        const PropertyHandler *handler)
+{
+    BOOL *repeat = (BOOL*)prop->data;
 
-        para->edge_motion_min_speed = speed[0];
-        para->edge_motion_max_speed = speed[1];
+    para->updown_button_repeat    = repeat[0];
+    para->leftright_button_repeat = repeat[1];
+    return Success;
+}
 
-    } else if (property == prop_edgemotion_always)
-    {
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_off(SynapticsParameters *para, XIPropertyValuePtr prop,
+        const PropertyHandler *handler)
+{
+    CARD8 off = *(CARD8*)prop->data;
 
-        para->edge_motion_use_always = *(BOOL*)prop->data;
+    if (off > 2)
+        return BadValue;
 
-    } else if (property == prop_buttonscroll)
-    {
-        BOOL *scroll;
+    para->touchpad_off = off;
+    return Success;
+}
 
-        if (prop->size != 2 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_tapaction(SynapticsParameters *para, XIPropertyValuePtr prop,
+              const PropertyHandler *handler)
+{
+    CARD8 *action = (CARD8*)prop->data;
+    int i;
 
-        scroll = (BOOL*)prop->data;
-        para->updown_button_scrolling    = scroll[0];
-        para->leftright_button_scrolling = scroll[1];
+    for (i = 0; i < prop->size; i++)
+        para->tap_action[i] = action[i];
+    return Success;
+}
 
-    } else if (property == prop_buttonscroll_repeat)
-    {
-        BOOL *repeat;
+static int
+set_clickaction(SynapticsParameters *para, XIPropertyValuePtr prop,
+                const PropertyHandler *handler)
+{
+    CARD8 *action = (CARD8*)prop->data;
+    int i;
 
-        if (prop->size != 2 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+    for (i = 0; i < prop->size; i++)
+        para->click_action[i] = action[i];
+    return Success;
+}
 
-        repeat = (BOOL*)prop->data;
-        para->updown_button_repeat    = repeat[0];
-        para->leftright_button_repeat = repeat[1];
-    } else if (property == prop_buttonscroll_time)
-    {
-        if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_circscroll_trigger(SynapticsParameters *para, XIPropertyValuePtr prop,
+                       const PropertyHandler *handler)
+{
+    CARD8 trigger = *(CARD8*)prop->data;
 
-        para->scroll_button_repeat = *(INT32*)prop->data;
+    if (trigger > 8)
+        return BadValue;
 
-    } else if (property == prop_off)
-    {
-        CARD8 off;
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+    para->circular_trigger = trigger;
+    return Success;
+}
 
-        off = *(CARD8*)prop->data;
+static int
+set_palm_dim(SynapticsParameters *para, XIPropertyValuePtr prop,
+             const PropertyHandler *handler)
+{
+    INT32 *dim = (INT32*)prop->data;
 
-        if (off > 2)
-            return BadValue;
+    para->palm_min_width = dim[0];
+    para->palm_min_z     = dim[1];
+    return Success;
+}
 
-        para->touchpad_off = off;
-    } else if (property == prop_guestmouse)
-    {
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_pressuremotion(SynapticsParameters *para, XIPropertyValuePtr prop,
+                   const PropertyHandler *handler)
+{
+    INT32 *press = (INT32*)prop->data;
 
-        para->guestmouse_off = *(BOOL*)prop->data;
-    } else if (property == prop_gestures)
-    {
-        BOOL *gestures;
+    if (press[0] > press[1])
+        return BadValue;
 
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+    para->press_motion_min_z = press[0];
+    para->press_motion_max_z = press[1];
+    return Success;
+}
 
-        gestures = (BOOL*)prop->data;
-        para->tap_and_drag_gesture = gestures[0];
-    } else if (property == prop_lockdrags)
-    {
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_pressuremotion_factor(SynapticsParameters *para, XIPropertyValuePtr prop,
+                          const PropertyHandler *handler)
+{
+    float *factor = (float*)prop->data;
 
-        para->locked_drags = *(BOOL*)prop->data;
-    } else if (property == prop_lockdrags_time)
-    {
-        if (prop->size != 1 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+    if (factor[0] > factor[1])
+        return BadValue;
 
-        para->locked_drag_time = *(INT32*)prop->data;
-    } else if (property == prop_tapaction)
-    {
-        int i;
-        CARD8 *action;
+    para->press_motion_min_factor = factor[0];
+    para->press_motion_max_factor = factor[1];
+    return Success;
+}
 
-        if (prop->size > MAX_TAP || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_coastfriction(SynapticsParameters *para, XIPropertyValuePtr prop,
+                  const PropertyHandler *handler)
+{
+    float friction = *(float*)prop->data;
 
-        action = (CARD8*)prop->data;
+    if (friction < 0)
+        return BadValue;
 
-        for (i = 0; i < MAX_TAP; i++)
-            para->tap_action[i] = action[i];
-    } else if (property == prop_clickaction)
-    {
-        int i;
-        CARD8 *action;
+    para->coasting_friction = friction;
+    return Success;
+}
+
+static int
+set_velocity_samples(SynapticsParameters *para, XIPropertyValuePtr prop,
+                     const PropertyHandler *handler)
+{
+    INT32 samples = *(INT32*)prop->data;
 
-        if (prop->size > MAX_CLICK || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+    if (samples < 2 || samples > SYNAPTICS_MOVE_HISTORY)
+        return BadValue;
 
-        action = (CARD8*)prop->data;
+    para->velocity_samples = samples;
+    return Success;
+}
 
-        for (i = 0; i < MAX_CLICK; i++)
-            para->click_action[i] = action[i];
-    } else if (property == prop_circscroll)
-    {
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+static int
+set_area(SynapticsParameters *para, XIPropertyValuePtr prop,
+         const PropertyHandler *handler)
+{
+    INT32 *area = (INT32*)prop->data;
 
-        para->circular_scrolling = *(BOOL*)prop->data;
+    if ((((area[0] != 0) && (area[1] != 0)) && (area[0] > area[1]) ) || (((area[2] != 0) && (area[3] != 0)) && (area[2] > area[3])))
+        return BadValue;
 
-    } else if (property == prop_circscroll_dist)
-    {
-        float circdist;
+    para->area_left_edge   = area[0];
+    para->area_right_edge  = area[1];
+    para->area_top_edge    = area[2];
+    para->area_bottom_edge = area[3];
+    return Success;
+}
 
-        if (prop->size != 1 || prop->format != 32 || prop->type != float_type)
-            return BadMatch;
+static const PropertyHandler prop_handlers[] = {
+    { &prop_edges,                 32, 4,         PROP_DERIVED,               set_edges },
+    { &prop_finger,                32, 3,         0,                          set_finger },
+    { &prop_tap_time,              32, 1,         0,                          set_int, PARAM(tap_time) },
+    { &prop_tap_move,              32, 1,         0,                          set_int, PARAM(tap_move) },
+    { &prop_tap_durations,         32, 3,         0,                          set_tap_durations },
+    { &prop_tap_fast,               8, 1,         0,                          set_bool, PARAM(fast_taps) },
+    { &prop_middle_timeout,        32, 1,         0,                          set_int, PARAM(emulate_mid_button_time) },
+    { &prop_twofinger_pressure,    32, 1,         0,                          set_int, PARAM(emulate_twofinger_z) },
+    { &prop_twofinger_width,       32, 1,         0,                          set_int, PARAM(emulate_twofinger_w) },
+    { &prop_scrolldist,            32, 2,         0,                          set_scrolldist },
+    { &prop_scrolledge,             8, 3,         0,                          set_scrolledge },
+    { &prop_scrolltwofinger,        8, 2,         0,                          set_scrolltwofinger },
+    { &prop_speed,                 32, 4,         PROP_FLOAT | PROP_DERIVED,  set_speed },
+    { &prop_accel_profile,         32, MAX_ACCEL_PROFILE + 1, PROP_FLOAT | PROP_MAX_SIZE | PROP_DERIVED, set_accel_profile },
+    { &prop_edgemotion_pressure,   32, 2,         PROP_DERIVED,               set_edgemotion_pressure },
+    { &prop_edgemotion_speed,      32, 2,         PROP_DERIVED,               set_edgemotion_speed },
+    { &prop_edgemotion_always,      8, 1,         0,                          set_bool, PARAM(edge_motion_use_always) },
+    { &prop_buttonscroll,           8, 2,         0,                          set_buttonscroll },
+    { &prop_buttonscroll_repeat,    8, 2,         0,                          set_buttonscroll_repeat },
+    { &prop_buttonscroll_time,     32, 1,         0,                          set_int, PARAM(scroll_button_repeat) },
+    { &prop_off,                    8, 1,         0,                          set_off },
+    { &prop_guestmouse,             8, 1,         0,                          set_bool, PARAM(guestmouse_off) },
+    { &prop_lockdrags,              8, 1,         0,                          set_bool, PARAM(locked_drags) },
+    { &prop_lockdrags_time,        32, 1,         0,                          set_int, PARAM(locked_drag_time) },
+    { &prop_tapaction,              8, MAX_TAP,   PROP_MAX_SIZE,              set_tapaction },
+    { &prop_clickaction,            8, MAX_CLICK, PROP_MAX_SIZE,              set_clickaction },
+    { &prop_circscroll,             8, 1,         0,                          set_bool, PARAM(circular_scrolling) },
+    { &prop_circscroll_dist,       32, 1,         PROP_FLOAT,                 set_double, PARAM(scroll_dist_circ) },
+    { &prop_circscroll_trigger,     8, 1,         0,                          set_circscroll_trigger },
+    { &prop_circpad,                8, 1,         0,                          set_bool, PARAM(circular_pad) },
+    { &prop_palm,                   8, 1,         0,                          set_bool, PARAM(palm_detect) },
+    { &prop_palm_dim,              32, 2,         0,                          set_palm_dim },
+    { &prop_coastspeed,            32, 1,         PROP_FLOAT,                 set_double, PARAM(coasting_speed) },
+    { &prop_coastfriction,         32, 1,         PROP_FLOAT,                 set_coastfriction },
+    { &prop_pressuremotion,        32, 2,         PROP_DERIVED,               set_pressuremotion },
+    { &prop_pressuremotion_factor, 32, 2,         PROP_FLOAT | PROP_DERIVED,  set_pressuremotion_factor },
+    { &prop_grab,                   8, 1,         0,                          set_bool, PARAM(grab_event_device) },
+    { &prop_gestures,               8, 1,         0,                          set_bool, PARAM(tap_and_drag_gesture) },
+    { &prop_capabilities,           8, 5,         PROP_READONLY,              NULL },
+    { &prop_resolution,            32, 2,         PROP_READONLY,              NULL },
+    { &prop_area,                  32, 4,         0,                          set_area },
+    { &prop_smooth_scrolling,       8, 1,         0,                          set_bool, PARAM(smooth_scrolling) },
+    { &prop_velocity_samples,      32, 1,         0,                          set_velocity_samples },
+};
+
+#define NUM_PROP_HANDLERS (sizeof(prop_handlers) / sizeof(prop_handlers[0]))
+
+/* Open addressing with linear probing, must be a power of two and larger
+ * than the number of handlers. */
+#define PROP_HASH_SIZE 128
+
+static const PropertyHandler *prop_hash[PROP_HASH_SIZE];
+
+/* Atoms are handed out sequentially, so their low bits spread well. */
+#define PROP_HASH(atom) ((atom) & (PROP_HASH_SIZE - 1))
+
+static void
+InitPropertyHandlers(void)
+{
+    unsigned int i, slot;
+
+    memset(prop_hash, 0, sizeof(prop_hash));
 
-        circdist = *(float*)prop->data;
-        para->scroll_dist_circ = circdist;
-    } else if (property == prop_circscroll_trigger)
+    for (i = 0; i < NUM_PROP_HANDLERS; i++)
     {
-        int trigger;
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+        Atom atom = *prop_handlers[i].atom;
 
-        trigger = *(CARD8*)prop->data;
-        if (trigger > 8)
-            return BadValue;
+        if (!atom)
+            continue;
 
-        para->circular_trigger = trigger;
+        slot = PROP_HASH(atom);
+        while (prop_hash[slot] && *prop_hash[slot]->atom != atom)
+            slot = (slot + 1) & (PROP_HASH_SIZE - 1);
+        prop_hash[slot] = &prop_handlers[i];
+    }
+}
 
-    } else if (property == prop_circpad)
-    {
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+static const PropertyHandler *
+FindPropertyHandler(Atom property)
+{
+    unsigned int slot = PROP_HASH(property);
 
-        para->circular_pad = *(BOOL*)prop->data;
-    } else if (property == prop_palm)
+    while (prop_hash[slot])
     {
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+        if (*prop_hash[slot]->atom == property)
+            return prop_hash[slot];
+        slot = (slot + 1) & (PROP_HASH_SIZE - 1);
+    }
 
-        para->palm_detect = *(BOOL*)prop->data;
-    } else if (property == prop_palm_dim)
-    {
-        INT32 *dim;
+    return NULL;
+}
 
-        if (prop->size != 2 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
+/* the acceleration profile is the largest property */
+#define MAX_PROP_VALUES (MAX_ACCEL_PROFILE + 1)
 
-        dim = (INT32*)prop->data;
+/* New value of one property changed by a parameter set */
+typedef struct _StagedProperty {
+    Bool changed;
+    XIPropertyValueRec prop;
+    union {
+        CARD8 card8[MAX_PROP_VALUES];
+        INT32 int32[MAX_PROP_VALUES];
+    } data;
+} StagedProperty;
 
-        para->palm_min_width = dim[0];
-        para->palm_min_z     = dim[1];
-    } else if (property == prop_coastspeed)
-    {
-        float speed;
+/*
+ * Apply a list of (atom, index, value) changes to several properties at
+ * once. All changes are validated against a copy of the parameters, which
+ * then replaces the live ones in one go, so the input code never sees half
+ * of a parameter set. Afterwards the changed properties are updated, which
+ * runs their handlers again with values that are already in place.
+ */
+static int
+SetParameterSet(DeviceIntPtr dev, XIPropertyValuePtr prop, BOOL checkonly)
+{
+    LocalDevicePtr local = (LocalDevicePtr) dev->public.devicePrivate;
+    SynapticsPrivate *priv = (SynapticsPrivate *) local->private;
+    SynapticsParameters tmp = priv->synpara;
+    StagedProperty staged[NUM_PROP_HANDLERS];
+    const PropertyHandler *handler;
+    XIPropertyValuePtr current;
+    StagedProperty *s;
+    CARD32 *changes;
+    unsigned int i, index;
+    int rc, sigstate;
+    Bool derived = FALSE;
 
-        if (prop->size != 1 || prop->format != 32 || prop->type != float_type)
-            return BadMatch;
+    if (prop->format != 32 || prop->type != XA_INTEGER || prop->size % 3)
+        return BadMatch;
 
-        speed = *(float*)prop->data;
-        para->coasting_speed = speed;
+    memset(staged, 0, sizeof(staged));
+    changes = (CARD32*)prop->data;
 
-    } else if (property == prop_pressuremotion)
+    for (i = 0; i < prop->size; i += 3)
     {
-        float *press;
-        if (prop->size != 2 || prop->format != 32 || prop->type != float_type)
-            return BadMatch;
+        handler = FindPropertyHandler(changes[i]);
+        index = changes[i + 1];
 
-        press = (float*)prop->data;
-        if (press[0] > press[1])
+        if (!handler || (handler->flags & PROP_READONLY))
+            return BadValue;
+        if (index >= handler->size)
             return BadValue;
 
-        para->press_motion_min_z = press[0];
-        para->press_motion_max_z = press[1];
-    } else if (property == prop_grab)
-    {
-        if (prop->size != 1 || prop->format != 8 || prop->type != XA_INTEGER)
-            return BadMatch;
+        /* start from the current value of the property */
+        s = &staged[handler - prop_handlers];
+        if (!s->changed)
+        {
+            if (XIGetDeviceProperty(dev, changes[i], &current) != Success)
+                return BadValue;
+            if (current->format != handler->format ||
+                current->size > handler->size)
+                return BadImplementation;
+
+            s->prop = *current;
+            memcpy(&s->data, current->data,
+                   current->size * current->format / 8);
+            s->prop.data = &s->data;
+            s->changed = TRUE;
+        }
 
-        para->grab_event_device = *(BOOL*)prop->data;
-    } else if (property == prop_capabilities)
-    {
-        /* read-only */
-        return BadValue;
-    } else if (property == prop_resolution)
+        /* tap and click actions may grow, the new values are zero */
+        if (index >= s->prop.size)
+            s->prop.size = index + 1;
+
+        if (handler->format == 8)
+            s->data.card8[index] = changes[i + 2];
+        else
+            s->data.int32[index] = changes[i + 2];
+    }
+
+    for (i = 0; i < NUM_PROP_HANDLERS; i++)
     {
-        /* read-only */
+        if (!staged[i].changed)
+            continue;
+        rc = prop_handlers[i].set(&tmp, &staged[i].prop, &prop_handlers[i]);
+        if (rc != Success)
+            return rc;
+        if (prop_handlers[i].flags & PROP_DERIVED)
+            derived = TRUE;
+    }
+
+    if (checkonly)
+        return Success;
+
+    /* ReadInput may run in the signal handler */
+    sigstate = xf86BlockSIGIO();
+    priv->synpara = tmp;
+    if (derived)
+        CalculateDerivedParameters(priv);
+    xf86UnblockSIGIO(sigstate);
+
+    for (i = 0; i < NUM_PROP_HANDLERS; i++)
+    {
+        if (!staged[i].changed)
+            continue;
+        XIChangeDeviceProperty(dev, *prop_handlers[i].atom,
+                               staged[i].prop.type, staged[i].prop.format,
+                               PropModeReplace, staged[i].prop.size,
+                               staged[i].prop.data, TRUE);
+    }
+
+    return Success;
+}
+
+int
+SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
+            BOOL checkonly)
+{
+    LocalDevicePtr local = (LocalDevicePtr) dev->public.devicePrivate;
+    SynapticsPrivate *priv = (SynapticsPrivate *) local->private;
+    SynapticsParameters *para = &priv->synpara;
+    SynapticsParameters tmp;
+    const PropertyHandler *handler;
+    int rc, sigstate;
+
+    if (property == prop_parameter_set)
+        return SetParameterSet(dev, prop, checkonly);
+
+    handler = FindPropertyHandler(property);
+    if (!handler)
+        return Success;
+
+    if (handler->flags & PROP_READONLY)
         return BadValue;
-    } else if (property == prop_area)
-    {
-        INT32 *area;
-        if (prop->size != 4 || prop->format != 32 || prop->type != XA_INTEGER)
-            return BadMatch;
 
-        area = (INT32*)prop->data;
-        if ((((area[0] != 0) && (area[1] != 0)) && (area[0] > area[1]) ) || (((area[2] != 0) && (area[3] != 0)) && (area[2] > area[3])))
-            return BadValue;
+    if (prop->format != handler->format ||
+        prop->type != ((handler->flags & PROP_FLOAT) ? float_type : XA_INTEGER))
+        return BadMatch;
 
-        para->area_left_edge   = area[0];
-        para->area_right_edge  = area[1];
-        para->area_top_edge    = area[2];
-        para->area_bottom_edge = area[3];
+    if ((handler->flags & PROP_MAX_SIZE) ? prop->size > handler->size
+                                         : prop->size != handler->size)
+        return BadMatch;
+
+    /* If checkonly is set, no parameters may be changed. So just let the code
+     * change temporary variables and forget about it. */
+    if (checkonly)
+    {
+        tmp = *para;
+        return handler->set(&tmp, prop, handler);
     }
 
-    return Success;
+    /* ReadInput may run in the signal handler */
+    sigstate = xf86BlockSIGIO();
+    rc = handler->set(para, prop, handler);
+    if (rc == Success && (handler->flags & PROP_DERIVED))
+        CalculateDerivedParameters(priv);
+    xf86UnblockSIGIO(sigstate);
+
+    return rc;
 }
 
 #endif
-
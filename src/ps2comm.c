@@ -42,6 +42,7 @@
 #include "synaptics.h"
 #include "synapticsstr.h"
 #include <xf86.h>
+#include <string.h>
 
 #define MAX_UNSYNC_PACKETS 10				/* i.e. 10 to 60 bytes */
 
@@ -71,14 +72,6 @@
 #define PS2DBG(x)
 #endif
 
-struct SynapticsHwInfo {
-    unsigned int model_id;		    /* Model-ID */
-    unsigned int capabilities;		    /* Capabilities */
-    unsigned int ext_cap;		    /* Extended Capabilities */
-    unsigned int identity;		    /* Identification */
-    Bool hasGuest;			    /* Has a guest mouse */
-};
-
 /*****************************************************************************
  *	PS/2 Utility functions.
  *     Many parts adapted from tpconfig.c by C. Scott Ananian
@@ -162,6 +155,290 @@ ps2_send_cmd(int fd, byte c)
 	    ps2_putbyte(fd, PS2_CMD_STATUS_REQUEST));
 }
 
+/*****************************************************************************
+ *	Asynchronous PS/2 command queue
+ ****************************************************************************/
+
+#define PS2_ASYNC_RETRIES 2
+
+static CARD32 ps2_async_timeout(OsTimerPtr timer, CARD32 now, pointer arg);
+
+static void
+ps2_async_arm(struct PS2AsyncQueue *q, int timeout)
+{
+    q->timer = TimerSet(q->timer, 0, timeout, ps2_async_timeout, q);
+}
+
+static void
+ps2_async_finish(struct PS2AsyncQueue *q, Bool success)
+{
+    PS2DBG(ErrorF("ps2_async: queue %s at command %d\n",
+		  success ? "done" : "aborted", q->cur));
+    q->cur = -1;
+    TimerCancel(q->timer);
+    if (q->done)
+	q->done(q->local, success);
+}
+
+static void
+ps2_async_send(struct PS2AsyncQueue *q)
+{
+    struct PS2AsyncCmd *cmd = &q->cmds[q->cur];
+
+    if (cmd->type == PS2_ASYNC_CMD) {
+	q->acked = FALSE;
+	q->resp_left = cmd->resp_len;
+	if (xf86WriteSerial(q->fd, &cmd->cmd, 1) != 1) {
+	    PS2DBG(ErrorF("ps2_async: error xf86WriteSerial\n"));
+	    ps2_async_finish(q, FALSE);
+	    return;
+	}
+	PS2DBG(ErrorF("ps2_async: byte %02X send\n", cmd->cmd));
+    } else if (cmd->type == PS2_ASYNC_GUEST)
+	q->resp_left = 6;
+    ps2_async_arm(q, cmd->timeout);
+}
+
+static void
+ps2_async_next(struct PS2AsyncQueue *q)
+{
+    if (++q->cur >= q->ncmds) {
+	ps2_async_finish(q, TRUE);
+	return;
+    }
+    q->retries = 0;
+    ps2_async_send(q);
+}
+
+static CARD32
+ps2_async_timeout(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    struct PS2AsyncQueue *q = arg;
+    int sigstate;
+
+    sigstate = xf86BlockSIGIO();
+
+    if (q->cur >= 0) {
+	enum PS2AsyncType type = q->cmds[q->cur].type;
+
+	if (type == PS2_ASYNC_QUIET || type == PS2_ASYNC_DRAIN)
+	    ps2_async_next(q);
+	else if (type == PS2_ASYNC_CMD && q->retries++ < PS2_ASYNC_RETRIES) {
+	    PS2DBG(ErrorF("ps2_async: timeout, resending\n"));
+	    ps2_async_send(q);
+	} else
+	    ps2_async_finish(q, FALSE);
+    }
+
+    xf86UnblockSIGIO(sigstate);
+    return 0;
+}
+
+/*
+ * Allocate the timer. Must not be called from the signal handler.
+ */
+Bool
+ps2_async_init(struct PS2AsyncQueue *q, LocalDevicePtr local)
+{
+    q->ncmds = 0;
+    q->cur = -1;
+    q->local = local;
+    q->fd = local->fd;
+    q->done = NULL;
+    q->timer = TimerSet(NULL, 0, 0, NULL, NULL);
+    return q->timer != NULL;
+}
+
+void
+ps2_async_fini(struct PS2AsyncQueue *q)
+{
+    if (q->timer) {
+	TimerCancel(q->timer);
+	TimerFree(q->timer);
+	q->timer = NULL;
+    }
+    q->cur = -1;
+}
+
+/*
+ * Stop any command in progress and empty the queue. The done callback is
+ * not called.
+ */
+void
+ps2_async_clear(struct PS2AsyncQueue *q)
+{
+    if (q->timer)
+	TimerCancel(q->timer);
+    q->cur = -1;
+    q->ncmds = 0;
+}
+
+void
+ps2_async_add(struct PS2AsyncQueue *q, byte cmd, int resp_len, int timeout)
+{
+    struct PS2AsyncCmd *c;
+
+    if (q->ncmds >= PS2_ASYNC_MAX_CMDS) {
+	xf86Msg(X_ERROR, "ps2_async: command queue full. This is a bug.\n");
+	return;
+    }
+    c = &q->cmds[q->ncmds++];
+    c->type = PS2_ASYNC_CMD;
+    c->cmd = cmd;
+    c->resp_len = resp_len;
+    c->timeout = timeout;
+}
+
+void
+ps2_async_add_quiet(struct PS2AsyncQueue *q, int timeout)
+{
+    ps2_async_add(q, 0, 0, timeout);
+    if (q->ncmds > 0)
+	q->cmds[q->ncmds - 1].type = PS2_ASYNC_QUIET;
+}
+
+void
+ps2_async_add_drain(struct PS2AsyncQueue *q, int timeout)
+{
+    ps2_async_add(q, 0, 0, timeout);
+    if (q->ncmds > 0)
+	q->cmds[q->ncmds - 1].type = PS2_ASYNC_DRAIN;
+}
+
+void
+ps2_async_start(struct PS2AsyncQueue *q,
+		void (*done)(LocalDevicePtr local, Bool success))
+{
+    q->done = done;
+    q->fd = q->local->fd;
+    q->cur = -1;
+    ps2_async_next(q);
+}
+
+Bool
+ps2_async_busy(const struct PS2AsyncQueue *q)
+{
+    return q->cur >= 0;
+}
+
+/*
+ * Feed a byte read from the device to the queue. Returns TRUE if the byte
+ * was consumed, FALSE if it should be processed as normal packet data.
+ */
+Bool
+ps2_async_input(struct PS2AsyncQueue *q, byte b)
+{
+    struct PS2AsyncCmd *cmd;
+
+    if (q->cur < 0)
+	return FALSE;
+
+    cmd = &q->cmds[q->cur];
+    if (cmd->type == PS2_ASYNC_QUIET) {
+	/* the line is not silent, give up */
+	ps2_async_finish(q, FALSE);
+	return FALSE;
+    } else if (cmd->type == PS2_ASYNC_DRAIN) {
+	/* restart the wait */
+	ps2_async_arm(q, cmd->timeout);
+	return TRUE;
+    } else if (cmd->type == PS2_ASYNC_GUEST) {
+	/* six byte pass-through packet, see ps2_getbyte_passthrough() */
+	switch (6 - q->resp_left) {
+	case 0:
+	    if ((b & 0xfc) != 0x84)
+		return TRUE;	/* not a pass-through packet, skip */
+	    break;
+	case 1:
+	    q->guest_data = b;
+	    break;
+	case 3:
+	    if ((b & 0xcc) != 0xc4) {
+		PS2DBG(ErrorF("ps2_async: expected 0xc4 and got: %02x\n", b & 0xcc));
+		ps2_async_finish(q, FALSE);
+		return TRUE;
+	    }
+	    break;
+	}
+	if (--q->resp_left > 0)
+	    return TRUE;
+	if (q->guest_data != cmd->cmd) {
+	    PS2DBG(ErrorF("ps2_async: guest sent %02x, expected %02x\n",
+			  q->guest_data, cmd->cmd));
+	    ps2_async_finish(q, FALSE);
+	} else
+	    ps2_async_next(q);
+	return TRUE;
+    }
+
+    if (!q->acked) {
+	switch (b) {
+	case PS2_ACK:
+	    q->acked = TRUE;
+	    break;
+	case PS2_CMD_RESEND:
+	    if (q->retries++ < PS2_ASYNC_RETRIES)
+		ps2_async_send(q);
+	    else
+		ps2_async_finish(q, FALSE);
+	    return TRUE;
+	case PS2_ERROR:
+	    PS2DBG(ErrorF("ps2_async: error response to 0x%02x\n", cmd->cmd));
+	    ps2_async_finish(q, FALSE);
+	    return TRUE;
+	default:
+	    /* stale packet data sent before the command was seen */
+	    return TRUE;
+	}
+    } else {
+	PS2DBG(ErrorF("ps2_async: response byte %02X\n", b));
+	q->resp_left--;
+    }
+
+    if (q->resp_left <= 0)
+	ps2_async_next(q);
+    return TRUE;
+}
+
+/*
+ * Queue the Synaptics special command sequence, see ps2_special_cmd().
+ */
+static void
+ps2_async_add_special(struct PS2AsyncQueue *q, byte cmd)
+{
+    int i;
+
+    ps2_async_add(q, PS2_CMD_SET_SCALING_1_1, 0, 100);
+    for (i = 0; i < 4; i++) {
+	ps2_async_add(q, PS2_CMD_SET_RESOLUTION, 0, 100);
+	ps2_async_add(q, (cmd >> 6) & 0x3, 0, 100);
+	cmd <<= 2;
+    }
+}
+
+/*
+ * Wait for the byte b from the guest device.
+ */
+static void
+ps2_async_add_guest_reply(struct PS2AsyncQueue *q, byte b, int timeout)
+{
+    ps2_async_add(q, b, 0, timeout);
+    if (q->ncmds > 0)
+	q->cmds[q->ncmds - 1].type = PS2_ASYNC_GUEST;
+}
+
+/*
+ * Queue a byte for the guest device, see ps2_putbyte_passthrough().
+ */
+static void
+ps2_async_add_guest(struct PS2AsyncQueue *q, byte c)
+{
+    ps2_async_add_special(q, c);
+    ps2_async_add(q, PS2_CMD_SET_SAMPLE_RATE, 0, 100);
+    ps2_async_add(q, 0x28, 0, 100);
+    ps2_async_add_guest_reply(q, PS2_ACK, 500);
+}
+
 /*****************************************************************************
  *	Synaptics passthrough functions
  ****************************************************************************/
@@ -445,9 +722,135 @@ ps2_print_ident(const struct SynapticsHwInfo *synhw)
     }
 }
 
+static void
+ps2_enable_done(LocalDevicePtr local, Bool success)
+{
+    if (!success)
+	DBG(3, "%s: enabling the touchpad failed\n", local->name);
+}
+
+static void
+ps2_guest_reinit_done(LocalDevicePtr local, Bool success)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct SynapticsHwInfo *synhw = (struct SynapticsHwInfo*)priv->proto_data;
+    struct PS2AsyncQueue *q = &synhw->queue;
+
+    if (success) {
+	DBG(3, "%s: touchpad re-initialized\n", local->name);
+	return;
+    }
+
+    /* the host is still disabled, turn it back on without the guest */
+    DBG(3, "%s: pass-through reset failed, disabling guest\n", local->name);
+    synhw->hasGuest = FALSE;
+    ps2_synaptics_select_decoder(synhw);
+
+    ps2_async_clear(q);
+    ps2_async_add_drain(q, 50);
+    ps2_async_add(q, PS2_CMD_ENABLE, 0, 100);
+    ps2_async_start(q, ps2_enable_done);
+}
+
+/*
+ * Reset the guest device on the pass-through port, see
+ * ps2_synaptics_reset_passthrough().
+ */
+static void
+ps2_start_guest_reinit(LocalDevicePtr local, struct SynapticsHwInfo *synhw)
+{
+    struct PS2AsyncQueue *q = &synhw->queue;
+
+    ps2_async_clear(q);
+    ps2_async_add(q, PS2_CMD_DISABLE, 0, 100);
+    ps2_async_add_guest(q, 0xff);
+    ps2_async_add_guest_reply(q, 0xaa, 1000);
+    ps2_async_add_guest_reply(q, 0x00, 500);
+    /* set defaults, turn on streaming, and enable the mouse */
+    ps2_async_add_guest(q, 0xf6);
+    ps2_async_add_guest(q, 0xea);
+    ps2_async_add_guest(q, 0xf4);
+    ps2_async_add(q, PS2_CMD_ENABLE, 0, 100);
+    ps2_async_start(q, ps2_guest_reinit_done);
+}
+
+static void
+ps2_reinit_done(LocalDevicePtr local, Bool success)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct SynapticsHwInfo *synhw = (struct SynapticsHwInfo*)priv->proto_data;
+
+    if (!success) {
+	DBG(3, "%s: touchpad re-initialization aborted\n", local->name);
+	return;
+    }
+
+    /* The pass-through port needs replies tunneled through the host */
+    if (synhw->hasGuest) {
+	ps2_start_guest_reinit(local, synhw);
+	return;
+    }
+
+    DBG(3, "%s: touchpad re-initialized\n", local->name);
+}
+
+/*
+ * Re-initialize the touchpad without blocking. If reset is TRUE, the
+ * touchpad is reset first, otherwise it is assumed to have reset itself and
+ * the mode is only restored if no more data arrives within 50ms. The
+ * touchpad is not identified again, the mode byte from PS2QueryHardware()
+ * is replayed instead.
+ */
+static void
+ps2_start_reinit(LocalDevicePtr local, struct SynapticsHwInfo *synhw, Bool reset)
+{
+    struct PS2AsyncQueue *q = &synhw->queue;
+
+    if (ps2_async_busy(q))
+	return;
+
+    ps2_async_clear(q);
+    if (reset) {
+	ps2_async_add(q, PS2_CMD_DISABLE, 0, 100);
+	ps2_async_add(q, PS2_CMD_RESET, 2, 1000);
+    } else
+	ps2_async_add_quiet(q, 50);
+    ps2_async_add_special(q, synhw->mode);
+    ps2_async_add(q, PS2_CMD_SET_SAMPLE_RATE, 0, 100);
+    ps2_async_add(q, 0x14, 0, 100);
+    ps2_async_add(q, PS2_CMD_ENABLE, 0, 100);
+    ps2_async_start(q, ps2_reinit_done);
+}
+
+static void
+PS2DeviceOnHook(LocalDevicePtr local, SynapticsParameters *para)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct SynapticsHwInfo *synhw;
+
+    if (!priv->proto_data)
+        priv->proto_data = xcalloc(1, sizeof(struct SynapticsHwInfo));
+    synhw = (struct SynapticsHwInfo*)priv->proto_data;
+    if (!synhw)
+	return;
+
+    synhw->async = ps2_async_init(&synhw->queue, local);
+    if (!synhw->async)
+	xf86Msg(X_WARNING, "%s: touchpad resets will block the server\n",
+		local->name);
+}
+
 static void
 PS2DeviceOffHook(LocalDevicePtr local)
 {
+    SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
+    struct SynapticsHwInfo *synhw = (struct SynapticsHwInfo*)priv->proto_data;
+
+    if (synhw) {
+	ps2_async_fini(&synhw->queue);
+	synhw->async = FALSE;
+    }
+
     ps2_synaptics_reset(local->fd);
     ps2_synaptics_enable_device(local->fd);
 }
@@ -463,6 +866,9 @@ PS2QueryHardware(LocalDevicePtr local)
         priv->proto_data = xcalloc(1, sizeof(struct SynapticsHwInfo));
     synhw = (struct SynapticsHwInfo*)priv->proto_data;
 
+    if (synhw->async)
+	ps2_async_clear(&synhw->queue);
+
     /* is the synaptics touchpad active? */
     if (!ps2_query_is_synaptics(local->fd, synhw))
 	return FALSE;
@@ -488,6 +894,7 @@ PS2QueryHardware(LocalDevicePtr local)
 	mode |= SYN_BIT_W_MODE;
     if (!ps2_synaptics_set_mode(local->fd, mode))
 	return FALSE;
+    synhw->mode = mode;
 
     /* Check to see if the host mouse supports a guest */
     synhw->hasGuest = FALSE;
@@ -507,41 +914,52 @@ PS2QueryHardware(LocalDevicePtr local)
 
     ps2_synaptics_enable_device(local->fd);
 
+    ps2_synaptics_select_decoder(synhw);
     ps2_print_ident(synhw);
 
     return TRUE;
 }
 
 /*
- * Decide if the current packet stored in priv->protoBuf is valid.
+ * Packet validity table. For every byte value, bit i is set if the byte is
+ * allowed at position i of a 6 byte packet. Index 0 is for the old absolute
+ * mode, index 1 for newabs.
  */
-static Bool
-ps2_packet_ok(struct SynapticsHwInfo *synhw, struct CommData *comm)
-{
-    unsigned char *buf = comm->protoBuf;
-    int newabs = SYN_MODEL_NEWABS(synhw);
-
-    if (newabs ? ((buf[0] & 0xC0) != 0x80) : ((buf[0] & 0xC0) != 0xC0)) {
-	DBG(4, "Synaptics driver lost sync at 1st byte\n");
-	return FALSE;
-    }
+static unsigned char ps2_sync_table[2][256];
+static Bool ps2_sync_table_ready = FALSE;
 
-    if (!newabs && ((buf[1] & 0x60) != 0x00)) {
-	DBG(4, "Synaptics driver lost sync at 2nd byte\n");
-	return FALSE;
-    }
-
-    if ((newabs ? ((buf[3] & 0xC0) != 0xC0) : ((buf[3] & 0xC0) != 0x80))) {
-	DBG(4, "Synaptics driver lost sync at 4th byte\n");
-	return FALSE;
-    }
-
-    if (!newabs && ((buf[4] & 0x60) != 0x00)) {
-	DBG(4, "Synaptics driver lost sync at 5th byte\n");
-	return FALSE;
+static void
+ps2_init_sync_table(void)
+{
+    int b, bits;
+
+    for (b = 0; b < 256; b++) {
+	/* old absolute mode */
+	bits = (1 << 2) | (1 << 5);
+	if ((b & 0xC0) == 0xC0)
+	    bits |= 1 << 0;
+	if ((b & 0x60) == 0x00)
+	    bits |= (1 << 1) | (1 << 4);
+	if ((b & 0xC0) == 0x80)
+	    bits |= 1 << 3;
+	ps2_sync_table[0][b] = bits;
+
+	/* newabs */
+	bits = (1 << 1) | (1 << 2) | (1 << 4) | (1 << 5);
+	if ((b & 0xC0) == 0x80)
+	    bits |= 1 << 0;
+	if ((b & 0xC0) == 0xC0)
+	    bits |= 1 << 3;
+	ps2_sync_table[1][b] = bits;
     }
+    ps2_sync_table_ready = TRUE;
+}
 
-    return TRUE;
+static void
+ps2_reset_packet(struct CommData *comm)
+{
+    comm->protoBufTail = 0;
+    comm->protoSync = 0;
 }
 
 static Bool
@@ -549,62 +967,198 @@ ps2_synaptics_get_packet(LocalDevicePtr local, struct SynapticsHwInfo *synhw,
 			 struct SynapticsProtocolOperations *proto_ops,
 			 struct CommData *comm)
 {
-    int count = 0;
-    int c;
+    const unsigned char *sync;
+    int c, head;
     unsigned char u;
 
+    if (!ps2_sync_table_ready)
+	ps2_init_sync_table();
+    sync = ps2_sync_table[SYN_MODEL_NEWABS(synhw) ? 1 : 0];
+
     while ((c = XisbRead(comm->buffer)) >= 0) {
 	u = (unsigned char)c;
 
+	/* replies to a re-initialization in progress */
+	if (synhw->async && ps2_async_input(&synhw->queue, u))
+	    continue;
+
 	/* test if there is a reset sequence received */
 	if ((c == 0x00) && (comm->lastByte == 0xAA)) {
-	    if (xf86WaitForInput(local->fd, 50000) == 0) {
+	    if (synhw->async) {
+		/* if the line stays silent, this was a real reset */
+		DBG(7, "Possible reset received\n");
+		ps2_start_reinit(local, synhw, FALSE);
+	    } else if (xf86WaitForInput(local->fd, 50000) == 0) {
 		DBG(7, "Reset received\n");
 		proto_ops->QueryHardware(local);
+		ps2_reset_packet(comm);
+		continue;
 	    } else
 		DBG(3, "faked reset received\n");
 	}
 	comm->lastByte = u;
 
-	/* to avoid endless loops */
-	if (count++ > 30) {
-	    xf86Msg(X_ERROR, "Synaptics driver lost sync... got gigantic packet!\n");
-	    return FALSE;
-	}
+	/* Store the byte twice, so the last 6 bytes are always available
+	   contiguously at protoRing[head + 1]. */
+	head = comm->protoRingHead;
+	comm->protoRing[head] = comm->protoRing[head + 6] = u;
+	comm->protoRingHead = (head + 1) % 6;
+	if (comm->protoBufTail < 6)
+	    comm->protoBufTail++;
 
-	comm->protoBuf[comm->protoBufTail++] = u;
+	/* Every candidate packet start that is still consistent moves one
+	   position further; a new candidate starts at this byte. */
+	comm->protoSync = ((comm->protoSync << 1) | 1) & sync[u];
 
-	/* Check that we have a valid packet. If not, we are out of sync,
-	   so we throw away the first byte in the packet.*/
-	if (comm->protoBufTail >= 6) {
-	    if (!ps2_packet_ok(synhw, comm)) {
-		int i;
-		for (i = 0; i < comm->protoBufTail - 1; i++)
-		    comm->protoBuf[i] = comm->protoBuf[i + 1];
-		comm->protoBufTail--;
-		comm->outOfSync++;
-		if (comm->outOfSync > MAX_UNSYNC_PACKETS) {
-		    comm->outOfSync = 0;
-		    DBG(3, "Synaptics synchronization lost too long -> reset touchpad.\n");
-		    proto_ops->QueryHardware(local); /* including a reset */
-		    continue;
-		}
-	    }
-	}
-
-	if (comm->protoBufTail >= 6) { /* Full packet received */
+	if (comm->protoSync & (1 << 5)) { /* Full packet received */
+	    memcpy(comm->protoBuf, &comm->protoRing[head + 1], 6);
 	    if (comm->outOfSync > 0) {
 		comm->outOfSync = 0;
 		DBG(4, "Synaptics driver resynced.\n");
 	    }
-	    comm->protoBufTail = 0;
+	    ps2_reset_packet(comm);
 	    return TRUE;
 	}
+
+	/* If we have a full window but no valid packet, we are out of sync
+	   and the oldest byte is thrown away. */
+	if (comm->protoBufTail >= 6) {
+	    DBG(4, "Synaptics driver lost sync\n");
+	    comm->outOfSync++;
+	    if (comm->outOfSync > MAX_UNSYNC_PACKETS) {
+		comm->outOfSync = 0;
+		DBG(3, "Synaptics synchronization lost too long -> reset touchpad.\n");
+		if (synhw->async)
+		    ps2_start_reinit(local, synhw, TRUE);
+		else
+		    proto_ops->QueryHardware(local); /* including a reset */
+		ps2_reset_packet(comm);
+	    }
+	}
     }
 
     return FALSE;
 }
 
+/*
+ * Packet decoders, one per packet format. They fill in position, pressure
+ * and buttons and return the raw w value.
+ */
+static int
+ps2_decode_old(const struct SynapticsHwInfo *synhw, const unsigned char *buf,
+	       struct SynapticsHwState *hw)
+{
+    hw->x = (((buf[1] & 0x1F) << 8) |
+	     buf[2]);
+    hw->y = (((buf[4] & 0x1F) << 8) |
+	     buf[5]);
+
+    hw->z = (((buf[0] & 0x30) << 2) |
+	     (buf[3] & 0x3F));
+
+    hw->left  = (buf[0] & 0x01) ? 1 : 0;
+    hw->right = (buf[0] & 0x02) ? 1 : 0;
+    hw->up = hw->down = hw->middle = FALSE;
+    memset(hw->multi, 0, sizeof(hw->multi));
+
+    return (((buf[1] & 0x80) >> 4) |
+	    ((buf[0] & 0x04) >> 1));
+}
+
+static int
+ps2_decode_newabs(const struct SynapticsHwInfo *synhw, const unsigned char *buf,
+		  struct SynapticsHwState *hw)
+{
+    hw->x = (((buf[3] & 0x10) << 8) |
+	     ((buf[1] & 0x0f) << 8) |
+	     buf[4]);
+    hw->y = (((buf[3] & 0x20) << 7) |
+	     ((buf[1] & 0xf0) << 4) |
+	     buf[5]);
+
+    hw->z = buf[2];
+
+    hw->left  = (buf[0] & 0x01) ? 1 : 0;
+    hw->right = (buf[0] & 0x02) ? 1 : 0;
+    hw->up = hw->down = hw->middle = FALSE;
+    memset(hw->multi, 0, sizeof(hw->multi));
+
+    return (((buf[0] & 0x30) >> 2) |
+	    ((buf[0] & 0x04) >> 1) |
+	    ((buf[3] & 0x04) >> 2));
+}
+
+/* newabs with extended capabilities: middle, up/down and multi buttons */
+static int
+ps2_decode_newabs_ext(const struct SynapticsHwInfo *synhw, const unsigned char *buf,
+		      struct SynapticsHwState *hw)
+{
+    int w = ps2_decode_newabs(synhw, buf, hw);
+    int i;
+
+    if (synhw->hasMiddle)
+	hw->middle = ((buf[0] ^ buf[3]) & 0x01) ? 1 : 0;
+    if (synhw->hasFourButtons) {
+	hw->up = ((buf[3] & 0x01) ^ hw->left) ? 1 : 0;
+	hw->down = (((buf[3] & 0x02) >> 1) ^ hw->right) ? 1 : 0;
+    }
+    /* multi buttons come in pairs, bit i of bytes 4 and 5 */
+    if (synhw->multiButtons && ((buf[3] & 2) ? !hw->right : hw->right)) {
+	for (i = 0; i < synhw->multiButtons / 2; i++) {
+	    hw->multi[2 * i]     = (buf[4] >> i) & 0x01;
+	    hw->multi[2 * i + 1] = (buf[5] >> i) & 0x01;
+	}
+    }
+
+    return w;
+}
+
+/*
+ * Choose the packet decoder and precompute everything that only depends on
+ * the capability bits, so that PS2ReadHwState does not look at them for
+ * every packet. Must be called whenever synhw changes.
+ */
+void
+ps2_synaptics_select_decoder(struct SynapticsHwInfo *synhw)
+{
+    Bool newabs = SYN_MODEL_NEWABS(synhw) ? TRUE : FALSE;
+    Bool extended = SYN_CAP_EXTENDED(synhw) ? TRUE : FALSE;
+    int multi;
+
+    synhw->guestPackets = newabs && synhw->hasGuest;
+    synhw->hasMiddle = extended && SYN_CAP_MIDDLE_BUTTON(synhw);
+    synhw->hasFourButtons = extended && SYN_CAP_FOUR_BUTTON(synhw);
+
+    multi = SYN_CAP_MULTI_BUTTON_NO(synhw) & ~0x01;
+    if (!extended || multi < 2)
+	multi = 0;
+    else if (multi > 8)
+	multi = 0;		/* as before, unknown counts are ignored */
+    synhw->multiButtons = multi;
+
+    /*
+     * Use capability bits to decide which w values are valid. Invalid
+     * values are replaced by 5, which corresponds to a finger of normal
+     * width.
+     */
+    synhw->wValid = 0;
+    if (extended) {
+	if (SYN_CAP_MULTIFINGER(synhw))
+	    synhw->wValid |= (1 << 0) | (1 << 1);
+	if (SYN_MODEL_PEN(synhw))
+	    synhw->wValid |= (1 << 2);
+	if (SYN_CAP_PALMDETECT(synhw))
+	    synhw->wValid |= 0xfff0;	/* 4 - 15 */
+    }
+
+    if (!newabs)
+	synhw->decode = ps2_decode_old;
+    else if (synhw->hasMiddle || synhw->hasFourButtons || synhw->multiButtons)
+	synhw->decode = ps2_decode_newabs_ext;
+    else
+	synhw->decode = ps2_decode_newabs;
+}
+
 static Bool
 PS2ReadHwState(LocalDevicePtr local,
 	       struct SynapticsProtocolOperations *proto_ops,
@@ -615,8 +1169,7 @@ PS2ReadHwState(LocalDevicePtr local,
     SynapticsPrivate *priv = (SynapticsPrivate *)local->private;
     SynapticsParameters *para = &priv->synpara;
     struct SynapticsHwInfo *synhw;
-    int newabs;
-    int w, i;
+    int w;
 
     synhw = (struct SynapticsHwInfo*)priv->proto_data;
     if (!synhw)
@@ -627,121 +1180,38 @@ PS2ReadHwState(LocalDevicePtr local,
         return FALSE;
     }
 
-    newabs = SYN_MODEL_NEWABS(synhw);
+    if (!synhw->decode)
+	ps2_synaptics_select_decoder(synhw);
 
     if (!ps2_synaptics_get_packet(local, synhw, proto_ops, comm))
 	return FALSE;
 
+    /* PS/2 packets carry no timestamp of their own */
+    hw->millis = GetTimeInMillis();
+
     /* Handle guest packets */
     hw->guest_dx = hw->guest_dy = 0;
-    if (newabs && synhw->hasGuest) {
-	w = (((buf[0] & 0x30) >> 2) |
-	     ((buf[0] & 0x04) >> 1) |
-	     ((buf[3] & 0x04) >> 2));
-	if (w == 3) {	       /* If w is 3, this is a guest packet */
-	    if (buf[4] != 0)
-		hw->guest_dx =   buf[4] - ((buf[1] & 0x10) ? 256 : 0);
-	    if (buf[5] != 0)
-		hw->guest_dy = -(buf[5] - ((buf[1] & 0x20) ? 256 : 0));
-	    hw->guest_left  = (buf[1] & 0x01) ? TRUE : FALSE;
-	    hw->guest_mid   = (buf[1] & 0x04) ? TRUE : FALSE;
-	    hw->guest_right = (buf[1] & 0x02) ? TRUE : FALSE;
-	    *hwRet = *hw;
-	    return TRUE;
-	}
+    if (synhw->guestPackets &&
+	(buf[0] & 0x34) == 0x04 && (buf[3] & 0x04)) {	/* w == 3 */
+	if (buf[4] != 0)
+	    hw->guest_dx =   buf[4] - ((buf[1] & 0x10) ? 256 : 0);
+	if (buf[5] != 0)
+	    hw->guest_dy = -(buf[5] - ((buf[1] & 0x20) ? 256 : 0));
+	hw->guest_left  = (buf[1] & 0x01) ? TRUE : FALSE;
+	hw->guest_mid   = (buf[1] & 0x04) ? TRUE : FALSE;
+	hw->guest_right = (buf[1] & 0x02) ? TRUE : FALSE;
+	*hwRet = *hw;
+	return TRUE;
     }
 
     /* Handle normal packets */
-    hw->x = hw->y = hw->z = hw->numFingers = hw->fingerWidth = 0;
-    hw->left = hw->right = hw->up = hw->down = hw->middle = FALSE;
-    for (i = 0; i < 8; i++)
-	hw->multi[i] = FALSE;
-
-    if (newabs) {			    /* newer protos...*/
-	DBG(7, "using new protocols\n");
-	hw->x = (((buf[3] & 0x10) << 8) |
-		 ((buf[1] & 0x0f) << 8) |
-		 buf[4]);
-	hw->y = (((buf[3] & 0x20) << 7) |
-		 ((buf[1] & 0xf0) << 4) |
-		 buf[5]);
-
-	hw->z = buf[2];
-	w = (((buf[0] & 0x30) >> 2) |
-	     ((buf[0] & 0x04) >> 1) |
-	     ((buf[3] & 0x04) >> 2));
-
-	hw->left  = (buf[0] & 0x01) ? 1 : 0;
-	hw->right = (buf[0] & 0x02) ? 1 : 0;
-
-	if (SYN_CAP_EXTENDED(synhw)) {
-	    if (SYN_CAP_MIDDLE_BUTTON(synhw)) {
-		hw->middle = ((buf[0] ^ buf[3]) & 0x01) ? 1 : 0;
-	    }
-	    if (SYN_CAP_FOUR_BUTTON(synhw)) {
-		hw->up = ((buf[3] & 0x01)) ? 1 : 0;
-		if (hw->left)
-		    hw->up = !hw->up;
-		hw->down = ((buf[3] & 0x02)) ? 1 : 0;
-		if (hw->right)
-		    hw->down = !hw->down;
-	    }
-	    if (SYN_CAP_MULTI_BUTTON_NO(synhw)) {
-		if ((buf[3] & 2) ? !hw->right : hw->right) {
-		    switch (SYN_CAP_MULTI_BUTTON_NO(synhw) & ~0x01) {
-		    default:
-			break;
-		    case 8:
-			hw->multi[7] = ((buf[5] & 0x08)) ? 1 : 0;
-			hw->multi[6] = ((buf[4] & 0x08)) ? 1 : 0;
-		    case 6:
-			hw->multi[5] = ((buf[5] & 0x04)) ? 1 : 0;
-			hw->multi[4] = ((buf[4] & 0x04)) ? 1 : 0;
-		    case 4:
-			hw->multi[3] = ((buf[5] & 0x02)) ? 1 : 0;
-			hw->multi[2] = ((buf[4] & 0x02)) ? 1 : 0;
-		    case 2:
-			hw->multi[1] = ((buf[5] & 0x01)) ? 1 : 0;
-			hw->multi[0] = ((buf[4] & 0x01)) ? 1 : 0;
-		    }
-		}
-	    }
-	}
-    } else {			    /* old proto...*/
-	DBG(7, "using old protocol\n");
-	hw->x = (((buf[1] & 0x1F) << 8) |
-		 buf[2]);
-	hw->y = (((buf[4] & 0x1F) << 8) |
-		 buf[5]);
-
-	hw->z = (((buf[0] & 0x30) << 2) |
-		 (buf[3] & 0x3F));
-	w = (((buf[1] & 0x80) >> 4) |
-	     ((buf[0] & 0x04) >> 1));
-
-	hw->left  = (buf[0] & 0x01) ? 1 : 0;
-	hw->right = (buf[0] & 0x02) ? 1 : 0;
-    }
+    w = synhw->decode(synhw, buf, hw);
+    hw->numFingers = hw->fingerWidth = 0;
 
     hw->y = YMAX_NOMINAL + YMIN_NOMINAL - hw->y;
 
     if (hw->z >= para->finger_high) {
-	int w_ok = 0;
-	/*
-	 * Use capability bits to decide if the w value is valid.
-	 * If not, set it to 5, which corresponds to a finger of
-	 * normal width.
-	 */
-	if (SYN_CAP_EXTENDED(synhw)) {
-	    if ((w >= 0) && (w <= 1)) {
-		w_ok = SYN_CAP_MULTIFINGER(synhw);
-	    } else if (w == 2) {
-		w_ok = SYN_MODEL_PEN(synhw);
-	    } else if ((w >= 4) && (w <= 15)) {
-		w_ok = SYN_CAP_PALMDETECT(synhw);
-	    }
-	}
-	if (!w_ok)
+	if (!(synhw->wValid & (1 << w)))
 	    w = 5;
 
 	switch (w) {
@@ -771,7 +1241,7 @@ PS2AutoDevProbe(LocalDevicePtr local)
 }
 
 struct SynapticsProtocolOperations psaux_proto_operations = {
-    NULL,
+    PS2DeviceOnHook,
     PS2DeviceOffHook,
     PS2QueryHardware,
     PS2ReadHwState,
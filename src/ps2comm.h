@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include "xf86_OSproc.h"
+#include <xf86Xinput.h>
 
 /* acknowledge for commands and parameter */
 #define PS2_ACK 			0xFA
@@ -94,10 +95,82 @@
 
 typedef unsigned char byte;
 
+/*
+ * Asynchronous command queue. Commands are written one at a time from the
+ * input handler and a timer, so sending them never blocks the server. The
+ * bytes read from the device must be passed to ps2_async_input() first.
+ */
+#define PS2_ASYNC_MAX_CMDS	64
+
+enum PS2AsyncType {
+    PS2_ASYNC_CMD,			    /* send a byte, wait for the ACK and
+					       resp_len response bytes */
+    PS2_ASYNC_QUIET,			    /* wait for the line to stay silent,
+					       abort the queue on any input */
+    PS2_ASYNC_DRAIN,			    /* discard input until the line stays
+					       silent */
+    PS2_ASYNC_GUEST			    /* wait for the byte cmd from the
+					       guest, tunneled through the host */
+};
+
+struct PS2AsyncCmd {
+    enum PS2AsyncType type;
+    byte cmd;
+    int resp_len;
+    int timeout;			    /* in ms */
+};
+
+struct PS2AsyncQueue {
+    struct PS2AsyncCmd cmds[PS2_ASYNC_MAX_CMDS];
+    int ncmds;
+    int cur;				    /* command in progress, -1 if idle */
+    Bool acked;
+    int resp_left;
+    int retries;
+    byte guest_data;			    /* data byte of the guest packet */
+    OsTimerPtr timer;
+    int fd;
+    LocalDevicePtr local;
+    void (*done)(LocalDevicePtr local, Bool success);
+};
+
+struct SynapticsHwState;
+
+struct SynapticsHwInfo {
+    unsigned int model_id;		    /* Model-ID */
+    unsigned int capabilities;		    /* Capabilities */
+    unsigned int ext_cap;		    /* Extended Capabilities */
+    unsigned int identity;		    /* Identification */
+    Bool hasGuest;			    /* Has a guest mouse */
+    byte mode;				    /* Mode byte set at initialization */
+    Bool async;				    /* Re-initialize asynchronously */
+    struct PS2AsyncQueue queue;
+
+    /* Packet decoding, set up by ps2_synaptics_select_decoder() */
+    int (*decode)(const struct SynapticsHwInfo *synhw,
+		  const unsigned char *buf,
+		  struct SynapticsHwState *hw);	/* returns the w value */
+    Bool guestPackets;			    /* w == 3 means guest packet */
+    unsigned int wValid;		    /* bit w set if w value is valid */
+    Bool hasMiddle;
+    Bool hasFourButtons;
+    int multiButtons;			    /* even number of multi buttons */
+};
 
 Bool ps2_putbyte(int fd, byte b);
 
-struct SynapticsHwInfo;
 void ps2_print_ident(const struct SynapticsHwInfo *synhw);
+void ps2_synaptics_select_decoder(struct SynapticsHwInfo *synhw);
+
+Bool ps2_async_init(struct PS2AsyncQueue *q, LocalDevicePtr local);
+void ps2_async_fini(struct PS2AsyncQueue *q);
+void ps2_async_clear(struct PS2AsyncQueue *q);
+void ps2_async_add(struct PS2AsyncQueue *q, byte cmd, int resp_len, int timeout);
+void ps2_async_add_quiet(struct PS2AsyncQueue *q, int timeout);
+void ps2_async_add_drain(struct PS2AsyncQueue *q, int timeout);
+void ps2_async_start(struct PS2AsyncQueue *q,
+		     void (*done)(LocalDevicePtr local, Bool success));
+Bool ps2_async_busy(const struct PS2AsyncQueue *q);
+Bool ps2_async_input(struct PS2AsyncQueue *q, byte b);
 
 #endif /* _PS2COMM_H_ */
@@ -45,19 +45,11 @@
 #include "synproto.h"
 #include "synaptics.h"
 #include "synapticsstr.h"
-#include "ps2comm.h"			    /* ps2_print_ident() */
+#include "ps2comm.h"			    /* struct SynapticsHwInfo, ps2_print_ident() */
 #include <xf86.h>
 
 #define SYSCALL(call) while (((call) == -1) && (errno == EINTR))
 
-struct SynapticsHwInfo {
-    unsigned int model_id;		    /* Model-ID */
-    unsigned int capabilities;		    /* Capabilities */
-    unsigned int ext_cap;		    /* Extended Capabilities */
-    unsigned int identity;		    /* Identification */
-    Bool hasGuest;			    /* Has a guest mouse */
-};
-
 /*
  * Identify Touchpad
  * See also the SYN_ID_* macros
@@ -162,6 +154,8 @@ PSMQueryHardware(LocalDevicePtr local)
         synhw->hasGuest = TRUE;
     }
 
+    ps2_synaptics_select_decoder(synhw);
+
     ps2_print_ident(synhw);
 
     return TRUE;
@@ -65,6 +65,16 @@
 #include <sys/shm.h>
 #include <math.h>
 #include <stdio.h>
+#include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/ipc.h>
+#ifdef HAVE_LINUX_FUTEX_H
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 #include <xf86_OSproc.h>
 #include <xf86Xinput.h>
 #include <exevents.h>
@@ -108,6 +118,7 @@ typedef enum {
 #endif
 
 #define INPUT_BUFFER_SIZE 200
+#define NUM_AXES 4			/* x, y, vertical and horizontal scroll */
 
 /*****************************************************************************
  * Forward declaration
@@ -116,6 +127,8 @@ static InputInfoPtr SynapticsPreInit(InputDriverPtr drv, IDevPtr dev, int flags)
 static void SynapticsUnInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags);
 static Bool DeviceControl(DeviceIntPtr, int);
 static void ReadInput(LocalDevicePtr);
+static CARD32 timerFunc(OsTimerPtr timer, CARD32 now, pointer arg);
+static CARD32 coastTimerFunc(OsTimerPtr timer, CARD32 now, pointer arg);
 static int HandleState(LocalDevicePtr, struct SynapticsHwState*);
 static int ControlProc(LocalDevicePtr, xDeviceCtl*);
 static void CloseProc(LocalDevicePtr);
@@ -237,10 +250,115 @@ SetDeviceAndProtocol(LocalDevicePtr local)
     }
 }
 
+#define SHM_KEY_TRIES 64		/* keys tried for a device's area */
+
+/*
+ * Preferred shared memory key of the device, see synaptics.h.
+ */
+static key_t
+shm_device_key(LocalDevicePtr local)
+{
+    char *device = xf86FindOptionValue(local->options, "Device");
+    key_t key;
+
+    if (device && (key = ftok(device, SHM_FTOK_ID)) != -1 &&
+	key != SHM_SYNAPTICS && key != IPC_PRIVATE)
+	return key;
+    return SHM_SYNAPTICS_DEVICE;
+}
+
+static key_t
+shm_next_key(key_t key)
+{
+    do
+	key = (key_t)((unsigned int)key + 1);
+    while (key == SHM_SYNAPTICS || key == IPC_PRIVATE || key == (key_t)-1);
+    return key;
+}
+
+/*
+ * Create the shared memory area of the device and return its id, or -1.
+ * An existing area is only removed if the process that created it is
+ * gone; otherwise it belongs to another device or X server and the next
+ * key is tried.
+ */
+static int
+shm_create(LocalDevicePtr local, key_t *keyP)
+{
+    key_t key = shm_device_key(local);
+    struct shmid_ds ds;
+    int shmid, i;
+
+    for (i = 0; i < SHM_KEY_TRIES; i++) {
+	if ((shmid = shmget(key, sizeof(SynapticsSHM),
+			    0774 | IPC_CREAT | IPC_EXCL)) != -1) {
+	    *keyP = key;
+	    return shmid;
+	}
+	if (errno != EEXIST)
+	    return -1;
+
+	if ((shmid = shmget(key, 0, 0)) != -1 &&
+	    shmctl(shmid, IPC_STAT, &ds) == 0 &&
+	    kill(ds.shm_cpid, 0) == -1 && errno == ESRCH) {
+	    DBG(3, "%s removing stale shared memory area 0x%x\n",
+		local->name, (unsigned int)key);
+	    shmctl(shmid, IPC_RMID, NULL);
+	} else
+	    key = shm_next_key(key);
+    }
+    return -1;
+}
+
+/*
+ * Add the device to the shared memory index, or remove it if add is FALSE.
+ * Entries left behind by X servers that no longer run are reused.
+ */
+static void
+shm_index_update(LocalDevicePtr local, key_t key, Bool add)
+{
+    SynapticsSHMIndex *index;
+    SynapticsSHMIndexEntry *e, *slot = NULL;
+    int shmid, i;
+
+    if ((shmid = shmget(SHM_SYNAPTICS, sizeof(SynapticsSHMIndex),
+			0774 | IPC_CREAT)) == -1 ||
+	(index = shmat(shmid, NULL, 0)) == (void *)-1) {
+	xf86Msg(X_WARNING, "%s can't access the shared memory index\n",
+		local->name);
+	return;
+    }
+
+    for (i = 0; i < SYNSHM_INDEX_SIZE; i++) {
+	e = &index->devices[i];
+	if (e->key == key && e->pid == getpid()) {
+	    slot = e;
+	    break;
+	}
+	if (!slot && add &&
+	    (e->key == 0 || (kill(e->pid, 0) == -1 && errno == ESRCH)))
+	    slot = e;
+    }
+
+    if (slot) {
+	slot->key = 0;
+	if (add) {
+	    SYNSHM_BARRIER();
+	    slot->pid = getpid();
+	    strncpy(slot->name, local->name, SYNSHM_NAME_LEN - 1);
+	    slot->name[SYNSHM_NAME_LEN - 1] = '\0';
+	    SYNSHM_BARRIER();
+	    slot->key = key;
+	}
+    } else if (add)
+	xf86Msg(X_WARNING, "%s shared memory index is full\n", local->name);
+
+    shmdt(index);
+}
+
 /*
- * Allocate and initialize read-only memory for the SynapticsParameters data to hold
- * driver settings.
- * The function will allocate shared memory if priv->shm_config is TRUE.
+ * Allocate the shared memory area if priv->shm_config is TRUE. Without
+ * it, the hardware states are not stored anywhere.
  */
 static Bool
 alloc_param_data(LocalDevicePtr local)
@@ -248,26 +366,24 @@ alloc_param_data(LocalDevicePtr local)
     int shmid;
     SynapticsPrivate *priv = local->private;
 
-    if (priv->synshm)
-	return TRUE;			    /* Already allocated */
+    if (!priv->shm_config || priv->synshm)
+	return TRUE;			    /* Not needed or already allocated */
 
-    if (priv->shm_config) {
-	if ((shmid = shmget(SHM_SYNAPTICS, 0, 0)) != -1)
-	    shmctl(shmid, IPC_RMID, NULL);
-	if ((shmid = shmget(SHM_SYNAPTICS, sizeof(SynapticsSHM),
-				0774 | IPC_CREAT)) == -1) {
-	    xf86Msg(X_ERROR, "%s error shmget\n", local->name);
-	    return FALSE;
-	}
-	if ((priv->synshm = (SynapticsSHM*)shmat(shmid, NULL, 0)) == NULL) {
-	    xf86Msg(X_ERROR, "%s error shmat\n", local->name);
-	    return FALSE;
-	}
-    } else {
-	priv->synshm = xcalloc(1, sizeof(SynapticsSHM));
-	if (!priv->synshm)
-	    return FALSE;
+    if ((shmid = shm_create(local, &priv->shm_key)) == -1) {
+	xf86Msg(X_ERROR, "%s error shmget\n", local->name);
+	return FALSE;
+    }
+    if ((priv->synshm = (SynapticsSHM*)shmat(shmid, NULL, 0)) == (void *)-1) {
+	priv->synshm = NULL;
+	shmctl(shmid, IPC_RMID, NULL);
+	xf86Msg(X_ERROR, "%s error shmat\n", local->name);
+	return FALSE;
     }
+    priv->synshm->version = (PACKAGE_VERSION_MAJOR*10000+PACKAGE_VERSION_MINOR*100+PACKAGE_VERSION_PATCHLEVEL);
+    priv->shm_id = shmid;
+    priv->shm_readers = FALSE;
+    priv->shm_check_time = GetTimeInMillis();
+    shm_index_update(local, priv->shm_key, TRUE);
 
     return TRUE;
 }
@@ -276,19 +392,17 @@ alloc_param_data(LocalDevicePtr local)
  * Free SynapticsParameters data previously allocated by alloc_param_data().
  */
 static void
-free_param_data(SynapticsPrivate *priv)
+free_param_data(LocalDevicePtr local)
 {
-    int shmid;
+    SynapticsPrivate *priv = local->private;
 
     if (!priv->synshm)
 	return;
 
-    if (priv->shm_config) {
-	if ((shmid = shmget(SHM_SYNAPTICS, 0, 0)) != -1)
-	    shmctl(shmid, IPC_RMID, NULL);
-    } else {
-	xfree(priv->synshm);
-    }
+    shm_index_update(local, priv->shm_key, FALSE);
+    shmdt(priv->synshm);
+    /* by id, so that only our own area is removed */
+    shmctl(priv->shm_id, IPC_RMID, NULL);
 
     priv->synshm = NULL;
 }
@@ -327,6 +441,50 @@ calculate_edge_widths(SynapticsPrivate *priv, int *l, int *r, int *t, int *b)
 }
 
 
+/*
+ * Parse the AccelProfile option: the distance between two samples,
+ * followed by the speed factors, separated by spaces or commas.
+ */
+static void
+parse_accel_profile(LocalDevicePtr local, SynapticsParameters *pars,
+		    const char *str)
+{
+    double values[MAX_ACCEL_PROFILE + 1];
+    char *end;
+    int i, n = 0;
+
+    pars->accel_profile_len = 0;
+    if (!str || !*str)
+	return;
+
+    while (*str) {
+	if (n > MAX_ACCEL_PROFILE)
+	    goto invalid;
+	values[n] = strtod(str, &end);
+	if (end == str)
+	    goto invalid;
+	n++;
+	str = end + strspn(end, " \t,");
+    }
+
+    if (n < 3 || !isfinite(values[0]) || values[0] < MIN_ACCEL_PROFILE_STEP)
+	goto invalid;
+    for (i = 1; i < n; i++)
+	if (!isfinite(values[i]) || values[i] < 0)
+	    goto invalid;
+
+    pars->accel_profile_step = values[0];
+    for (i = 1; i < n; i++)
+	pars->accel_profile[i - 1] = values[i];
+    pars->accel_profile_len = n - 1;
+    return;
+
+invalid:
+    xf86Msg(X_WARNING, "%s: Invalid AccelProfile, need a step of at least %g "
+	    "and 2 to %d speed factors. Ignoring.\n", local->name,
+	    MIN_ACCEL_PROFILE_STEP, MAX_ACCEL_PROFILE);
+}
+
 static void set_default_parameters(LocalDevicePtr local)
 {
     SynapticsPrivate *priv = local->private; /* read-only */
@@ -351,10 +509,6 @@ static void set_default_parameters(LocalDevicePtr local)
     int horizResolution = 1;
     int vertResolution = 1;
 
-    /* read the parameters */
-    if (priv->synshm)
-        priv->synshm->version = (PACKAGE_VERSION_MAJOR*10000+PACKAGE_VERSION_MINOR*100+PACKAGE_VERSION_PATCHLEVEL);
-
     /* The synaptics specs specify typical edge widths of 4% on x, and 5.4% on
      * y (page 7) [Synaptics TouchPad Interfacing Guide, 510-000080 - A
      * Second Edition, http://www.synaptics.com/support/dev_support.cfm, 8 Sep
@@ -511,6 +665,7 @@ static void set_default_parameters(LocalDevicePtr local)
     pars->click_action[F2_CLICK1] = xf86SetIntOption(opts, "ClickFinger2", clickFinger2);
     pars->click_action[F3_CLICK1] = xf86SetIntOption(opts, "ClickFinger3", clickFinger3);
     pars->circular_scrolling = xf86SetBoolOption(opts, "CircularScrolling", FALSE);
+    pars->smooth_scrolling = xf86SetBoolOption(opts, "SmoothScrolling", FALSE);
     pars->circular_trigger   = xf86SetIntOption(opts, "CircScrollTrigger", 0);
     pars->circular_pad       = xf86SetBoolOption(opts, "CircularPad", FALSE);
     pars->palm_detect        = xf86SetBoolOption(opts, "PalmDetect", FALSE);
@@ -524,8 +679,11 @@ static void set_default_parameters(LocalDevicePtr local)
     pars->max_speed = xf86SetRealOption(opts, "MaxSpeed", 0.7);
     pars->accl = xf86SetRealOption(opts, "AccelFactor", accelFactor);
     pars->trackstick_speed = xf86SetRealOption(opts, "TrackstickSpeed", 40);
+    parse_accel_profile(local, pars, xf86FindOptionValue(opts, "AccelProfile"));
     pars->scroll_dist_circ = xf86SetRealOption(opts, "CircScrollDelta", 0.1);
     pars->coasting_speed = xf86SetRealOption(opts, "CoastingSpeed", 0.0);
+    pars->coasting_friction = xf86SetRealOption(opts, "CoastingFriction", 50.0);
+    pars->velocity_samples = xf86SetIntOption(opts, "VelocitySamples", 4);
     pars->press_motion_min_factor = xf86SetRealOption(opts, "PressureMotionMinFactor", 1.0);
     pars->press_motion_max_factor = xf86SetRealOption(opts, "PressureMotionMaxFactor", 1.0);
     pars->grab_event_device = xf86SetBoolOption(opts, "GrabEventDevice", TRUE);
@@ -541,6 +699,14 @@ static void set_default_parameters(LocalDevicePtr local)
 	xf86Msg(X_WARNING, "%s: TopEdge is bigger than BottomEdge. Fixing.\n",
 		local->name);
     }
+
+    if (pars->velocity_samples < 2 || pars->velocity_samples > SYNAPTICS_MOVE_HISTORY) {
+	pars->velocity_samples = MAX(2, MIN(pars->velocity_samples, SYNAPTICS_MOVE_HISTORY));
+	xf86Msg(X_WARNING, "%s: VelocitySamples must be 2 to %d. Using %d.\n",
+		local->name, SYNAPTICS_MOVE_HISTORY, pars->velocity_samples);
+    }
+
+    CalculateDerivedParameters(priv);
 }
 
 /*
@@ -559,7 +725,10 @@ SynapticsPreInit(InputDriverPtr drv, IDevPtr dev, int flags)
 
     /* allocate now so we don't allocate in the signal handler */
     priv->timer = TimerSet(NULL, 0, 0, NULL, NULL);
-    if (!priv->timer) {
+    priv->coast_timer = TimerSet(NULL, 0, 0, NULL, NULL);
+    if (!priv->timer || !priv->coast_timer) {
+	xfree(priv->timer);
+	xfree(priv->coast_timer);
 	xfree(priv);
 	return NULL;
     }
@@ -568,6 +737,7 @@ SynapticsPreInit(InputDriverPtr drv, IDevPtr dev, int flags)
     local = xf86AllocateInput(drv, 0);
     if (!local) {
 	xfree(priv->timer);
+	xfree(priv->coast_timer);
 	xfree(priv);
 	return NULL;
     }
@@ -666,9 +836,10 @@ SynapticsPreInit(InputDriverPtr drv, IDevPtr dev, int flags)
 
     if (priv->comm.buffer)
 	XisbFree(priv->comm.buffer);
-    free_param_data(priv);
+    free_param_data(local);
     xfree(priv->proto_data);
     xfree(priv->timer);
+    xfree(priv->coast_timer);
     xfree(priv);
     local->private = NULL;
     return local;
@@ -685,6 +856,8 @@ static void SynapticsUnInit(InputDriverPtr drv,
     SynapticsPrivate *priv = ((SynapticsPrivate *)local->private);
     if (priv && priv->timer)
         xfree(priv->timer);
+    if (priv && priv->coast_timer)
+        xfree(priv->coast_timer);
     if (priv && priv->proto_data)
         xfree(priv->proto_data);
     xfree(local->private);
@@ -753,6 +926,7 @@ DeviceOn(DeviceIntPtr dev)
     }
 
     xf86FlushInput(local->fd);
+    priv->last_millis = GetTimeInMillis();
 
     /* reinit the pad */
     if (!QueryHardware(local))
@@ -780,6 +954,9 @@ DeviceOff(DeviceIntPtr dev)
 
     if (local->fd != -1) {
 	TimerCancel(priv->timer);
+	priv->timer_armed = FALSE;
+	TimerCancel(priv->coast_timer);
+	priv->coast_armed = FALSE;
 	xf86RemoveEnabledDevice(local);
         if (priv->proto_ops->DeviceOffHook)
             priv->proto_ops->DeviceOffHook(local);
@@ -789,6 +966,8 @@ DeviceOff(DeviceIntPtr dev)
 	}
 	xf86CloseSerial(local->fd);
     }
+    /* the server releases the buttons of a disabled device */
+    priv->posted_buttons = 0;
     dev->public.on = FALSE;
     return Success;
 }
@@ -803,7 +982,9 @@ DeviceClose(DeviceIntPtr dev)
     RetValue = DeviceOff(dev);
     TimerFree(priv->timer);
     priv->timer = NULL;
-    free_param_data(priv);
+    TimerFree(priv->coast_timer);
+    priv->coast_timer = NULL;
+    free_param_data(local);
     return RetValue;
 }
 
@@ -814,6 +995,10 @@ static void InitAxesLabels(Atom *labels, int nlabels)
     switch(nlabels)
     {
         default:
+        case 4:
+            labels[3] = XIGetKnownProperty(AXIS_LABEL_PROP_REL_HWHEEL);
+        case 3:
+            labels[2] = XIGetKnownProperty(AXIS_LABEL_PROP_REL_WHEEL);
         case 2:
             labels[1] = XIGetKnownProperty(AXIS_LABEL_PROP_REL_Y);
         case 1:
@@ -857,9 +1042,9 @@ DeviceInit(DeviceIntPtr dev)
     int min, max;
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 7
     Atom btn_labels[SYN_MAX_BUTTONS] = { 0 };
-    Atom axes_labels[2] = { 0 };
+    Atom axes_labels[NUM_AXES] = { 0 };
 
-    InitAxesLabels(axes_labels, 2);
+    InitAxesLabels(axes_labels, NUM_AXES);
     InitButtonLabels(btn_labels, SYN_MAX_BUTTONS);
 #endif
 
@@ -884,7 +1069,7 @@ DeviceInit(DeviceIntPtr dev)
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) == 0
 			    miPointerGetMotionBufferSize()
 #else
-			    GetMotionHistorySize(), 2
+			    GetMotionHistorySize(), NUM_AXES
 #endif
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 7
                             , axes_labels
@@ -926,6 +1111,16 @@ DeviceInit(DeviceIntPtr dev)
             min, max, priv->resy * 1000, 0, priv->resy * 1000);
     xf86InitValuatorDefaults(dev, 1);
 
+    /* Vertical and horizontal scroll valuators, used by SmoothScrolling */
+    for (i = 2; i < NUM_AXES; i++) {
+	xf86InitValuatorAxisStruct(dev, i,
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 7
+		axes_labels[i],
+#endif
+		0, -1, 0, 0, 0);
+	xf86InitValuatorDefaults(dev, i);
+    }
+
 #if GET_ABI_MAJOR(ABI_XINPUT_VERSION) == 0
     xf86MotionHistoryAllocate(local);
 #endif
@@ -941,10 +1136,36 @@ DeviceInit(DeviceIntPtr dev)
     return Success;
 }
 
+#ifdef FIXED_POINT_MOTION
+/* integer square root, rounded down */
+static int
+isqrt(unsigned int n)
+{
+    unsigned int root = 0, bit = 1U << 30;
+
+    while (bit > n)
+	bit >>= 2;
+    while (bit) {
+	if (n >= root + bit) {
+	    n -= root + bit;
+	    root = (root >> 1) + bit;
+	} else {
+	    root >>= 1;
+	}
+	bit >>= 2;
+    }
+    return root;
+}
+#endif
+
 static int
 move_distance(int dx, int dy)
 {
+#ifdef FIXED_POINT_MOTION
+    return isqrt(SQR(dx) + SQR(dy));
+#else
     return sqrt(SQR(dx) + SQR(dy));
+#endif
 }
 
 /*
@@ -956,41 +1177,59 @@ static void
 relative_coords(SynapticsPrivate *priv, int x, int y,
 		double *relX, double *relY)
 {
-    int minX = priv->synpara.left_edge;
-    int maxX = priv->synpara.right_edge;
-    int minY = priv->synpara.top_edge;
-    int maxY = priv->synpara.bottom_edge;
-    double xCenter = (minX + maxX) / 2.0;
-    double yCenter = (minY + maxY) / 2.0;
+    SynapticsDerivedParameters *derived = &priv->derived;
 
-    if ((maxX - xCenter > 0) && (maxY - yCenter > 0)) {
-	*relX = (x - xCenter) / (maxX - xCenter);
-	*relY = (y - yCenter) / (maxY - yCenter);
+    if ((derived->inv_half_width > 0) && (derived->inv_half_height > 0)) {
+	*relX = (x - derived->center_x) * derived->inv_half_width;
+	*relY = (y - derived->center_y) * derived->inv_half_height;
     } else {
 	*relX = 0;
 	*relY = 0;
     }
 }
 
+/*
+ * atan2() approximation, accurate to 0.0016 radians (0.09 degrees). That
+ * is good enough for circular scrolling, whose steps are at least 0.005
+ * radians, and a lot cheaper than the real thing.
+ */
+static double
+fast_atan2(double y, double x)
+{
+    double ax = fabs(x), ay = fabs(y);
+    double z, a;
+
+    if (ax == 0 && ay == 0)
+	return 0;
+
+    /* atan() of the smaller ratio, in [0, 1] */
+    z = (ax >= ay) ? ay / ax : ax / ay;
+    a = M_PI_4 * z - z * (z - 1) * (0.2447 + 0.0663 * z);
+
+    if (ay > ax)
+	a = M_PI_2 - a;
+    if (x < 0)
+	a = M_PI - a;
+    return (y < 0) ? -a : a;
+}
+
 /* return angle of point relative to center */
 static double
 angle(SynapticsPrivate *priv, int x, int y)
 {
-    double xCenter = (priv->synpara.left_edge + priv->synpara.right_edge) / 2.0;
-    double yCenter = (priv->synpara.top_edge + priv->synpara.bottom_edge) / 2.0;
-
-    return atan2(-(y - yCenter), x - xCenter);
+    return fast_atan2(-(y - priv->derived.center_y), x - priv->derived.center_x);
 }
 
-/* return angle difference */
+/* return angle difference, for angles in [-PI, PI] */
 static double
 diffa(double a1, double a2)
 {
-    double da = fmod(a2 - a1, 2 * M_PI);
-    if (da < 0)
-	da += 2 * M_PI;
+    double da = a2 - a1;
+
     if (da > M_PI)
 	da -= 2 * M_PI;
+    else if (da <= -M_PI)
+	da += 2 * M_PI;
     return da;
 }
 
@@ -1063,6 +1302,36 @@ is_inside_active_area(SynapticsPrivate *priv, int x, int y)
     return inside_area;
 }
 
+/*
+ * Run timerFunc delay milliseconds after now. While packets are coming in,
+ * the deadline moves later with every packet, but the timer is only
+ * reprogrammed when the new deadline is earlier than the one it is armed
+ * for. If it fires early, timerFunc moves it on to the current deadline.
+ */
+static void
+schedule_timer(LocalDevicePtr local, CARD32 now, int delay)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) (local->private);
+    CARD32 wakeUpTime;
+
+    priv->timer_deadline = now + delay;
+    if (priv->timer_armed && TIME_DIFF(priv->timer_deadline, priv->timer_expires) >= 0)
+	return;
+
+    /*
+     * Workaround for wraparound bug in the TimerSet function. This bug is already
+     * fixed in CVS, but this driver needs to work with XFree86 versions 4.2.x and
+     * 4.3.x too.
+     */
+    wakeUpTime = priv->timer_deadline;
+    if (wakeUpTime <= now)
+	wakeUpTime = 0xffffffffL;
+
+    priv->timer_expires = wakeUpTime;
+    priv->timer_armed = TRUE;
+    priv->timer = TimerSet(priv->timer, TimerAbsolute, wakeUpTime, timerFunc, local);
+}
+
 static CARD32
 timerFunc(OsTimerPtr timer, CARD32 now, pointer arg)
 {
@@ -1071,25 +1340,27 @@ timerFunc(OsTimerPtr timer, CARD32 now, pointer arg)
     struct SynapticsHwState hw;
     int delay;
     int sigstate;
-    CARD32 wakeUpTime;
 
     sigstate = xf86BlockSIGIO();
 
+    priv->timer_armed = FALSE;
+
+    /* packets arrived since the timer was armed, the state is up to date */
+    if (TIME_DIFF(priv->timer_deadline, now) > 0) {
+	schedule_timer(local, now, TIME_DIFF(priv->timer_deadline, now));
+	xf86UnblockSIGIO(sigstate);
+	return 0;
+    }
+
     hw = priv->hwState;
     hw.guest_dx = hw.guest_dy = 0;
     hw.millis = now;
+    if (TIME_DIFF(priv->last_millis, hw.millis) > 0)
+	hw.millis = priv->last_millis;
+    priv->last_millis = hw.millis;
     delay = HandleState(local, &hw);
 
-    /*
-     * Workaround for wraparound bug in the TimerSet function. This bug is already
-     * fixed in CVS, but this driver needs to work with XFree86 versions 4.2.x and
-     * 4.3.x too.
-     */
-    wakeUpTime = now + delay;
-    if (wakeUpTime <= now)
-	wakeUpTime = 0xffffffffL;
-
-    priv->timer = TimerSet(priv->timer, TimerAbsolute, wakeUpTime, timerFunc, local);
+    schedule_timer(local, now, delay);
 
     xf86UnblockSIGIO(sigstate);
 
@@ -1127,14 +1398,17 @@ ReadInput(LocalDevicePtr local)
     Bool newDelay = FALSE;
 
     while (SynapticsGetHwState(local, priv, &hw)) {
-	hw.millis = GetTimeInMillis();
+	/* kernel timestamps may lag behind the last timer run */
+	if (TIME_DIFF(priv->last_millis, hw.millis) > 0)
+	    hw.millis = priv->last_millis;
+	priv->last_millis = hw.millis;
 	priv->hwState = hw;
 	delay = HandleState(local, &hw);
 	newDelay = TRUE;
     }
 
     if (newDelay)
-	priv->timer = TimerSet(priv->timer, 0, delay, timerFunc, local);
+	schedule_timer(local, GetTimeInMillis(), delay);
 }
 
 static int
@@ -1556,12 +1830,12 @@ HandleTapProcessing(SynapticsPrivate *priv, struct SynapticsHwState *hw,
     return delay;
 }
 
-#define HIST(a) (priv->move_hist[((priv->hist_index - (a) + SYNAPTICS_MOVE_HISTORY) % SYNAPTICS_MOVE_HISTORY)])
+#define HIST(a) (priv->move_hist[(priv->hist_index - (a)) & (SYNAPTICS_MOVE_HISTORY - 1)])
 
 static void
 store_history(SynapticsPrivate *priv, int x, int y, unsigned int millis)
 {
-    int idx = (priv->hist_index + 1) % SYNAPTICS_MOVE_HISTORY;
+    int idx = (priv->hist_index + 1) & (SYNAPTICS_MOVE_HISTORY - 1);
     priv->move_hist[idx].x = x;
     priv->move_hist[idx].y = y;
     priv->move_hist[idx].millis = millis;
@@ -1569,25 +1843,304 @@ store_history(SynapticsPrivate *priv, int x, int y, unsigned int millis)
 }
 
 /*
- * Estimate the slope for the data sequence [x3, x2, x1, x0] by using
- * linear regression to fit a line to the data and use the slope of the
- * line.
+ * Estimate the finger velocity by fitting a line to the last n positions
+ * over their timestamps (linear least squares). The samples are the
+ * current packet and the history, or only the history if hw is NULL.
+ * The velocity in units per millisecond is vx_num / den and vy_num / den;
+ * den is 0 if all samples have the same timestamp. The sums are exact
+ * integers, so the fixed point code can use them too.
+ *
+ * For evenly spaced samples and n = 4, this is the slope
+ * (3 * x0 + x1 - x2 - 3 * x3) / 10 per packet.
+ */
+static void
+estimate_velocity(SynapticsPrivate *priv, const struct SynapticsHwState *hw,
+		  int n, int64_t *vx_num, int64_t *vy_num, int64_t *den)
+{
+    int64_t st = 0, stt = 0, sx = 0, sy = 0, stx = 0, sty = 0;
+    int first = hw ? 0 : 1;
+    int x0, y0, t0, i;
+
+    /* relative to the newest sample, which then adds nothing to the sums */
+    x0 = hw ? hw->x : HIST(0).x;
+    y0 = hw ? hw->y : HIST(0).y;
+    t0 = hw ? hw->millis : HIST(0).millis;
+
+    for (i = first; i < n - 1 + first; i++) {
+	int64_t t = HIST(i).millis - t0;
+	int64_t x = HIST(i).x - x0;
+	int64_t y = HIST(i).y - y0;
+
+	st += t;
+	stt += t * t;
+	sx += x;
+	sy += y;
+	stx += t * x;
+	sty += t * y;
+    }
+
+    *den = n * stt - st * st;
+    *vx_num = n * stx - st * sx;
+    *vy_num = n * sty - st * sy;
+}
+
+/*
+ * Edge motion speed when dragging at the edges of the touchpad.
+ */
+static void
+get_edge_speed(SynapticsPrivate *priv, struct SynapticsHwState *hw,
+	       edge_type edge, int *x_edge_speed, int *y_edge_speed)
+{
+    SynapticsParameters *para = &priv->synpara;
+    int minZ = para->edge_motion_min_z;
+    int maxZ = para->edge_motion_max_z;
+    int edge_speed;
+
+    if (hw->z <= minZ) {
+	edge_speed = para->edge_motion_min_speed;
+    } else if (hw->z >= maxZ) {
+	edge_speed = para->edge_motion_max_speed;
+    } else {
+#ifdef FIXED_POINT_MOTION
+	edge_speed = para->edge_motion_min_speed +
+	    FIXED_TO_INT((hw->z - minZ) * priv->derived.edge_motion_slope_fixed);
+#else
+	edge_speed = para->edge_motion_min_speed +
+	    (int)((hw->z - minZ) * priv->derived.edge_motion_slope);
+#endif
+    }
+    if (!para->circular_pad) {
+	/* on rectangular pad */
+	if (edge & RIGHT_EDGE) {
+	    *x_edge_speed = edge_speed;
+	} else if (edge & LEFT_EDGE) {
+	    *x_edge_speed = -edge_speed;
+	}
+	if (edge & TOP_EDGE) {
+	    *y_edge_speed = -edge_speed;
+	} else if (edge & BOTTOM_EDGE) {
+	    *y_edge_speed = edge_speed;
+	}
+    } else if (edge) {
+	/* at edge of circular pad */
+	double relX, relY;
+
+	relative_coords(priv, hw->x, hw->y, &relX, &relY);
+	*x_edge_speed = (int)(edge_speed * relX);
+	*y_edge_speed = (int)(edge_speed * relY);
+    }
+}
+
+#ifdef FIXED_POINT_MOTION
+
+/* accel_speed() in fixed point */
+static fixed_t
+accel_speed_fixed(SynapticsPrivate *priv, int dist)
+{
+    SynapticsDerivedParameters *derived = &priv->derived;
+    int len = priv->synpara.accel_profile_len;
+    fixed_t speed, *profile;
+    int64_t pos;
+    int i;
+
+    if (len > 0) {
+	profile = derived->accel_profile_fixed;
+	pos = (int64_t)dist * derived->accel_profile_inv_step_fixed;
+	if (pos >= (int64_t)(len - 1) * FIXED_ONE)
+	    return profile[len - 1];
+	i = pos >> FIXED_SHIFT;
+	return profile[i] + FIXED_MUL(profile[i + 1] - profile[i],
+				      pos & (FIXED_ONE - 1));
+    }
+
+    speed = dist * derived->accl_fixed;
+    if (speed > derived->max_speed_fixed) {
+	speed = derived->max_speed_fixed;
+    } else if (speed < derived->min_speed_fixed) {
+	speed = derived->min_speed_fixed;
+    }
+    return speed;
+}
+
+/*
+ * Pointer motion for this packet, with acceleration, pressure motion and
+ * edge motion applied. The fractions left over are carried to the next
+ * packet. Fixed point version of the code below, see there.
+ */
+static void
+relative_motion(SynapticsPrivate *priv, struct SynapticsHwState *hw,
+		enum MovingState moving_state, int samples,
+		int x_edge_speed, int y_edge_speed, int *dxP, int *dyP)
+{
+    SynapticsDerivedParameters *derived = &priv->derived;
+    SynapticsParameters *para = &priv->synpara;
+    int dtime = hw->millis - HIST(0).millis;	/* in ms */
+    fixed_t dx = 0, dy = 0;
+    fixed_t speed, tmp;
+    int dist;
+
+    /* no time passed, e.g. a packet right after a timer run */
+    if (dtime <= 0) {
+	*dxP = *dyP = 0;
+	return;
+    }
+
+    if (priv->moving_state == MS_TRACKSTICK) {
+	dx = ((int64_t)(hw->x - priv->trackstick_neutral_x) * dtime *
+	      derived->trackstick_speed_fixed) / 1000;
+	dy = ((int64_t)(hw->y - priv->trackstick_neutral_y) * dtime *
+	      derived->trackstick_speed_fixed) / 1000;
+    } else if (moving_state == MS_TOUCHPAD_RELATIVE) {
+	int64_t vx, vy, den;
+
+	/* the distance moved at that velocity since the last packet */
+	estimate_velocity(priv, hw, samples, &vx, &vy, &den);
+	if (den > 0) {
+	    dx = (vx * dtime * FIXED_ONE) / den;
+	    dy = (vy * dtime * FIXED_ONE) / den;
+	}
+    }
+
+    /* speed depending on distance/packet */
+    dist = move_distance(FIXED_TO_INT(dx), FIXED_TO_INT(dy));
+    speed = accel_speed_fixed(priv, dist);
+
+    /* modify speed according to pressure */
+    if (priv->moving_state == MS_TOUCHPAD_RELATIVE) {
+	int minZ = para->press_motion_min_z;
+	int maxZ = para->press_motion_max_z;
+
+	if (hw->z <= minZ) {
+	    speed = FIXED_MUL(speed, derived->press_motion_min_factor_fixed);
+	} else if (hw->z >= maxZ) {
+	    speed = FIXED_MUL(speed, derived->press_motion_max_factor_fixed);
+	} else {
+	    speed = FIXED_MUL(speed, derived->press_motion_min_factor_fixed +
+			      (hw->z - minZ) * derived->press_motion_slope_fixed);
+	}
+    }
+
+    /* save the fraction, report the integer part */
+    tmp = FIXED_MUL(dx, speed) +
+	((int64_t)x_edge_speed * dtime * FIXED_ONE) / 1000 + priv->frac_x;
+    *dxP = FIXED_TO_INT(tmp);
+    priv->frac_x = tmp - INT_TO_FIXED(*dxP);
+    tmp = FIXED_MUL(dy, speed) +
+	((int64_t)y_edge_speed * dtime * FIXED_ONE) / 1000 + priv->frac_y;
+    *dyP = FIXED_TO_INT(tmp);
+    priv->frac_y = tmp - INT_TO_FIXED(*dyP);
+}
+
+#else /* FIXED_POINT_MOTION */
+
+/*
+ * Speed factor for a finger movement of dist units in one packet. It is
+ * interpolated from the acceleration profile if there is one, otherwise
+ * it grows linearly with AccelFactor from MinSpeed to MaxSpeed.
  */
 static double
-estimate_delta(double x0, double x1, double x2, double x3)
+accel_speed(SynapticsPrivate *priv, int dist)
+{
+    SynapticsParameters *para = &priv->synpara;
+    int len = para->accel_profile_len;
+    double speed, pos;
+    int i;
+
+    if (len > 0) {
+	pos = dist * priv->derived.accel_profile_inv_step;
+	/* compare before the conversion, pos may not fit an int */
+	if (!(pos < len - 1))
+	    return para->accel_profile[len - 1];
+	i = (int)pos;
+	return para->accel_profile[i] +
+	    (pos - i) * (para->accel_profile[i + 1] - para->accel_profile[i]);
+    }
+
+    speed = dist * para->accl;
+    if (speed > para->max_speed) {  /* set max speed factor */
+	speed = para->max_speed;
+    } else if (speed < para->min_speed) { /* set min speed factor */
+	speed = para->min_speed;
+    }
+    return speed;
+}
+
+/*
+ * Pointer motion for this packet, with acceleration, pressure motion and
+ * edge motion applied. The fractions left over are carried to the next
+ * packet.
+ */
+static void
+relative_motion(SynapticsPrivate *priv, struct SynapticsHwState *hw,
+		enum MovingState moving_state, int samples,
+		int x_edge_speed, int y_edge_speed, int *dxP, int *dyP)
 {
-    return x0 * 0.3 + x1 * 0.1 - x2 * 0.1 - x3 * 0.3;
+    SynapticsParameters *para = &priv->synpara;
+    double dtime = (hw->millis - HIST(0).millis) / 1000.0;
+    double dx = 0, dy = 0;
+    double speed, tmpf, integral;
+    int dist;
+
+    /* no time passed, e.g. a packet right after a timer run */
+    if (dtime <= 0) {
+	*dxP = *dyP = 0;
+	return;
+    }
+
+    if (priv->moving_state == MS_TRACKSTICK) {
+	dx = (hw->x - priv->trackstick_neutral_x);
+	dy = (hw->y - priv->trackstick_neutral_y);
+
+	dx = dx * dtime * para->trackstick_speed;
+	dy = dy * dtime * para->trackstick_speed;
+    } else if (moving_state == MS_TOUCHPAD_RELATIVE) {
+	int64_t vx, vy, den;
+
+	/* the distance moved at that velocity since the last packet */
+	estimate_velocity(priv, hw, samples, &vx, &vy, &den);
+	if (den > 0) {
+	    dx = (double)vx * (hw->millis - HIST(0).millis) / den;
+	    dy = (double)vy * (hw->millis - HIST(0).millis) / den;
+	}
+    }
+
+    /* speed depending on distance/packet */
+    dist = move_distance(dx, dy);
+    speed = accel_speed(priv, dist);
+
+    /* modify speed according to pressure */
+    if (priv->moving_state == MS_TOUCHPAD_RELATIVE) {
+	int minZ = para->press_motion_min_z;
+	int maxZ = para->press_motion_max_z;
+
+	if (hw->z <= minZ) {
+	    speed *= para->press_motion_min_factor;
+	} else if (hw->z >= maxZ) {
+	    speed *= para->press_motion_max_factor;
+	} else {
+	    speed *= para->press_motion_min_factor +
+		(hw->z - minZ) * priv->derived.press_motion_slope;
+	}
+    }
+
+    /* save the fraction, report the integer part */
+    tmpf = dx * speed + x_edge_speed * dtime + priv->frac_x;
+    priv->frac_x = modf(tmpf, &integral);
+    *dxP = integral;
+    tmpf = dy * speed + y_edge_speed * dtime + priv->frac_y;
+    priv->frac_y = modf(tmpf, &integral);
+    *dyP = integral;
 }
 
+#endif /* FIXED_POINT_MOTION */
+
 static int
 ComputeDeltas(SynapticsPrivate *priv, struct SynapticsHwState *hw,
 	      edge_type edge, int *dxP, int *dyP)
 {
     SynapticsParameters *para = &priv->synpara;
     enum MovingState moving_state;
-    int dist;
-    double dx, dy;
-    double speed, integral;
+    int dx, dy;
     int delay = 1000000000;
 
     dx = dy = 0;
@@ -1615,90 +2168,16 @@ ComputeDeltas(SynapticsPrivate *priv, struct SynapticsHwState *hw,
 	!priv->circ_scroll_on) {
 	delay = MIN(delay, 13);
 	if (priv->count_packet_finger > 3) { /* min. 3 packets */
-	    double tmpf;
 	    int x_edge_speed = 0;
 	    int y_edge_speed = 0;
-	    double dtime = (hw->millis - HIST(0).millis) / 1000.0;
-
-	    if (priv->moving_state == MS_TRACKSTICK) {
-		dx = (hw->x - priv->trackstick_neutral_x);
-		dy = (hw->y - priv->trackstick_neutral_y);
-
-		dx = dx * dtime * para->trackstick_speed;
-		dy = dy * dtime * para->trackstick_speed;
-	    } else if (moving_state == MS_TOUCHPAD_RELATIVE) {
-		dx = estimate_delta(hw->x, HIST(0).x, HIST(1).x, HIST(2).x);
-		dy = estimate_delta(hw->y, HIST(0).y, HIST(1).y, HIST(2).y);
-
-		if ((priv->tap_state == TS_DRAG) || para->edge_motion_use_always) {
-		    int minZ = para->edge_motion_min_z;
-		    int maxZ = para->edge_motion_max_z;
-		    int minSpd = para->edge_motion_min_speed;
-		    int maxSpd = para->edge_motion_max_speed;
-		    int edge_speed;
-
-		    if (hw->z <= minZ) {
-			edge_speed = minSpd;
-		    } else if (hw->z >= maxZ) {
-			edge_speed = maxSpd;
-		    } else {
-			edge_speed = minSpd + (hw->z - minZ) * (maxSpd - minSpd) / (maxZ - minZ);
-		    }
-		    if (!priv->synpara.circular_pad) {
-			/* on rectangular pad */
-			if (edge & RIGHT_EDGE) {
-			    x_edge_speed = edge_speed;
-			} else if (edge & LEFT_EDGE) {
-			    x_edge_speed = -edge_speed;
-			}
-			if (edge & TOP_EDGE) {
-			    y_edge_speed = -edge_speed;
-			} else if (edge & BOTTOM_EDGE) {
-			    y_edge_speed = edge_speed;
-			}
-		    } else if (edge) {
-			/* at edge of circular pad */
-			double relX, relY;
-
-			relative_coords(priv, hw->x, hw->y, &relX, &relY);
-			x_edge_speed = (int)(edge_speed * relX);
-			y_edge_speed = (int)(edge_speed * relY);
-		    }
-		}
-	    }
-
-	    /* speed depending on distance/packet */
-	    dist = move_distance(dx, dy);
-	    speed = dist * para->accl;
-	    if (speed > para->max_speed) {  /* set max speed factor */
-		speed = para->max_speed;
-	    } else if (speed < para->min_speed) { /* set min speed factor */
-		speed = para->min_speed;
-	    }
 
-	    /* modify speed according to pressure */
-	    if (priv->moving_state == MS_TOUCHPAD_RELATIVE) {
-		int minZ = para->press_motion_min_z;
-		int maxZ = para->press_motion_max_z;
-		double minFctr = para->press_motion_min_factor;
-		double maxFctr = para->press_motion_max_factor;
-
-		if (hw->z <= minZ) {
-		    speed *= minFctr;
-		} else if (hw->z >= maxZ) {
-		    speed *= maxFctr;
-		} else {
-		    speed *= minFctr + (hw->z - minZ) * (maxFctr - minFctr) / (maxZ - minZ);
-		}
-	    }
+	    if ((moving_state == MS_TOUCHPAD_RELATIVE) &&
+		((priv->tap_state == TS_DRAG) || para->edge_motion_use_always))
+		get_edge_speed(priv, hw, edge, &x_edge_speed, &y_edge_speed);
 
-	    /* save the fraction, report the integer part */
-	    tmpf = dx * speed + x_edge_speed * dtime + priv->frac_x;
-	    priv->frac_x = modf(tmpf, &integral);
-	    dx = integral;
-	    tmpf = dy * speed + y_edge_speed * dtime + priv->frac_y;
-	    priv->frac_y = modf(tmpf, &integral);
-	    dy = integral;
+	    relative_motion(priv, hw, moving_state,
+			    MIN(para->velocity_samples, priv->count_packet_finger + 1),
+			    x_edge_speed, y_edge_speed, &dx, &dy);
 	}
 
 	priv->count_packet_finger++;
@@ -1723,6 +2202,7 @@ ComputeDeltas(SynapticsPrivate *priv, struct SynapticsHwState *hw,
 
 struct ScrollData {
     int left, right, up, down;
+    double delta_x, delta_y;		/* smooth scrolling, in scroll steps */
 };
 
 static void
@@ -1735,25 +2215,30 @@ start_coasting(SynapticsPrivate *priv, struct SynapticsHwState *hw, edge_type ed
     priv->autoscroll_x = 0.0;
 
     if ((priv->scroll_packet_count > 3) && (para->coasting_speed > 0.0)) {
-	double pkt_time = (HIST(0).millis - HIST(3).millis) / 1000.0;
+	int64_t vx, vy, den;
+
+	/* the finger is already up, use the packets before */
+	estimate_velocity(priv, NULL,
+			  MIN(para->velocity_samples, priv->scroll_packet_count),
+			  &vx, &vy, &den);
 	if (vertical) {
-	    double dy = estimate_delta(HIST(0).y, HIST(1).y, HIST(2).y, HIST(3).y);
 	    int sdelta = para->scroll_dist_vert;
-	    if ((edge & RIGHT_EDGE) && pkt_time > 0 && sdelta > 0) {
-		double scrolls_per_sec = dy / pkt_time / sdelta;
+	    if ((edge & RIGHT_EDGE) && den > 0 && sdelta > 0) {
+		double scrolls_per_sec = 1000.0 * vy / den / sdelta;
 		if (fabs(scrolls_per_sec) >= para->coasting_speed) {
 		    priv->autoscroll_yspd = scrolls_per_sec;
 		    priv->autoscroll_y = (hw->y - priv->scroll_y) / (double)sdelta;
+		    priv->coast_time = hw->millis;
 		}
 	    }
 	} else {
-	    double dx = estimate_delta(HIST(0).x, HIST(1).x, HIST(2).x, HIST(3).x);
 	    int sdelta = para->scroll_dist_horiz;
-	    if ((edge & BOTTOM_EDGE) && pkt_time > 0 && sdelta > 0) {
-		double scrolls_per_sec = dx / pkt_time / sdelta;
+	    if ((edge & BOTTOM_EDGE) && den > 0 && sdelta > 0) {
+		double scrolls_per_sec = 1000.0 * vx / den / sdelta;
 		if (fabs(scrolls_per_sec) >= para->coasting_speed) {
 		    priv->autoscroll_xspd = scrolls_per_sec;
 		    priv->autoscroll_x = (hw->x - priv->scroll_x) / (double)sdelta;
+		    priv->coast_time = hw->millis;
 		}
 	    }
 	}
@@ -1767,6 +2252,35 @@ stop_coasting(SynapticsPrivate *priv)
     priv->autoscroll_xspd = 0;
     priv->autoscroll_yspd = 0;
     priv->scroll_packet_count = 0;
+    if (priv->coast_armed) {
+	TimerCancel(priv->coast_timer);
+	priv->coast_armed = FALSE;
+    }
+}
+
+/*
+ * Position used for two-finger scrolling. If the device reports individual
+ * contacts, this is their centroid, otherwise the single position reported
+ * by the hardware. Returns the number of contacts the position is made of.
+ */
+static int
+twofinger_position(const struct SynapticsHwState *hw, int *x, int *y)
+{
+    int i, sx = 0, sy = 0;
+
+    if (hw->numTouches < 2) {
+	*x = hw->x;
+	*y = hw->y;
+	return 1;
+    }
+
+    for (i = 0; i < hw->numTouches; i++) {
+	sx += hw->touches[i].x;
+	sy += hw->touches[i].y;
+    }
+    *x = sx / hw->numTouches;
+    *y = sy / hw->numTouches;
+    return hw->numTouches;
 }
 
 static int
@@ -1775,8 +2289,11 @@ HandleScrolling(SynapticsPrivate *priv, struct SynapticsHwState *hw,
 {
     SynapticsParameters *para = &priv->synpara;
     int delay = 1000000000;
+    int tf_x, tf_y, tf_touches;
 
     sd->left = sd->right = sd->up = sd->down = 0;
+    sd->delta_x = sd->delta_y = 0.0;
+    tf_touches = twofinger_position(hw, &tf_x, &tf_y);
 
     if (priv->synpara.touchpad_off == 2) {
 	stop_coasting(priv);
@@ -1815,14 +2332,14 @@ HandleScrolling(SynapticsPrivate *priv, struct SynapticsHwState *hw,
 		    (para->scroll_twofinger_vert) && (para->scroll_dist_vert != 0)) {
 		    priv->vert_scroll_twofinger_on = TRUE;
 		    priv->vert_scroll_edge_on = FALSE;
-		    priv->scroll_y = hw->y;
+		    priv->scroll_y = tf_y;
 		    DBG(7, "vert two-finger scroll detected\n");
 		}
 		if (!priv->horiz_scroll_twofinger_on &&
 		    (para->scroll_twofinger_horiz) && (para->scroll_dist_horiz != 0)) {
 		    priv->horiz_scroll_twofinger_on = TRUE;
 		    priv->horiz_scroll_edge_on = FALSE;
-		    priv->scroll_x = hw->x;
+		    priv->scroll_x = tf_x;
 		    DBG(7, "horiz two-finger scroll detected\n");
 		}
 	    }
@@ -1939,15 +2456,29 @@ HandleScrolling(SynapticsPrivate *priv, struct SynapticsHwState *hw,
 	priv->scroll_packet_count++;
     }
 
+    /* The centroid jumps when a contact comes or goes, don't scroll by
+     * that, continue from the new position instead */
+    if (tf_touches != priv->scroll_touches) {
+	if (priv->vert_scroll_twofinger_on)
+	    priv->scroll_y = tf_y;
+	if (priv->horiz_scroll_twofinger_on)
+	    priv->scroll_x = tf_x;
+	priv->scroll_touches = tf_touches;
+    }
+
     if (priv->vert_scroll_edge_on || priv->vert_scroll_twofinger_on) {
 	/* + = down, - = up */
 	int delta = para->scroll_dist_vert;
-	if (delta > 0) {
-	    while (hw->y - priv->scroll_y > delta) {
+	int y = priv->vert_scroll_twofinger_on ? tf_y : hw->y;
+	if (delta > 0 && para->smooth_scrolling) {
+	    sd->delta_y += (double)(y - priv->scroll_y) / delta;
+	    priv->scroll_y = y;
+	} else if (delta > 0) {
+	    while (y - priv->scroll_y > delta) {
 		sd->down++;
 		priv->scroll_y += delta;
 	    }
-	    while (hw->y - priv->scroll_y < -delta) {
+	    while (y - priv->scroll_y < -delta) {
 		sd->up++;
 		priv->scroll_y -= delta;
 	    }
@@ -1956,12 +2487,16 @@ HandleScrolling(SynapticsPrivate *priv, struct SynapticsHwState *hw,
     if (priv->horiz_scroll_edge_on || priv->horiz_scroll_twofinger_on) {
 	/* + = right, - = left */
 	int delta = para->scroll_dist_horiz;
-	if (delta > 0) {
-	    while (hw->x - priv->scroll_x > delta) {
+	int x = priv->horiz_scroll_twofinger_on ? tf_x : hw->x;
+	if (delta > 0 && para->smooth_scrolling) {
+	    sd->delta_x += (double)(x - priv->scroll_x) / delta;
+	    priv->scroll_x = x;
+	} else if (delta > 0) {
+	    while (x - priv->scroll_x > delta) {
 		sd->right++;
 		priv->scroll_x += delta;
 	    }
-	    while (hw->x - priv->scroll_x < -delta) {
+	    while (x - priv->scroll_x < -delta) {
 		sd->left++;
 		priv->scroll_x -= delta;
 	    }
@@ -1970,54 +2505,44 @@ HandleScrolling(SynapticsPrivate *priv, struct SynapticsHwState *hw,
     if (priv->circ_scroll_on) {
 	/* + = counter clockwise, - = clockwise */
 	double delta = para->scroll_dist_circ;
-	if (delta >= 0.005) {
-	    while (diffa(priv->scroll_a, angle(priv, hw->x, hw->y)) > delta) {
+	if (delta >= 0.005 && para->smooth_scrolling) {
+	    double a = angle(priv, hw->x, hw->y);
+	    double da = diffa(priv->scroll_a, a);
+
+	    if (priv->circ_scroll_vert)
+		sd->delta_y -= da / delta;
+	    else
+		sd->delta_x += da / delta;
+	    priv->scroll_a = a;
+	} else if (delta >= 0.005) {
+	    double da = diffa(priv->scroll_a, angle(priv, hw->x, hw->y));
+	    /* number of whole steps, strictly less than da */
+	    int steps = (int)(fabs(da) / delta);
+
+	    if (steps > 0 && steps * delta >= fabs(da))
+		steps--;
+
+	    if (da > 0) {
 		if (priv->circ_scroll_vert)
-		    sd->up++;
+		    sd->up += steps;
 		else
-		    sd->right++;
-		priv->scroll_a += delta;
+		    sd->right += steps;
+		priv->scroll_a += steps * delta;
 		if (priv->scroll_a > M_PI)
 		    priv->scroll_a -= 2 * M_PI;
-	    }
-	    while (diffa(priv->scroll_a, angle(priv, hw->x, hw->y)) < -delta) {
+	    } else {
 		if (priv->circ_scroll_vert)
-		    sd->down++;
+		    sd->down += steps;
 		else
-		    sd->left++;
-		priv->scroll_a -= delta;
+		    sd->left += steps;
+		priv->scroll_a -= steps * delta;
 		if (priv->scroll_a < -M_PI)
 		    priv->scroll_a += 2 * M_PI;
 	    }
 	}
     }
 
-    if (priv->autoscroll_yspd) {
-	double dtime = (hw->millis - HIST(0).millis) / 1000.0;
-	priv->autoscroll_y += priv->autoscroll_yspd * dtime;
-	delay = MIN(delay, 20);
-	while (priv->autoscroll_y > 1.0) {
-	    sd->down++;
-	    priv->autoscroll_y -= 1.0;
-	}
-	while (priv->autoscroll_y < -1.0) {
-	    sd->up++;
-	    priv->autoscroll_y += 1.0;
-	}
-    }
-    if (priv->autoscroll_xspd) {
-	double dtime = (hw->millis - HIST(0).millis) / 1000.0;
-	priv->autoscroll_x += priv->autoscroll_xspd * dtime;
-	delay = MIN(delay, 20);
-	while (priv->autoscroll_x > 1.0) {
-	    sd->right++;
-	    priv->autoscroll_x -= 1.0;
-	}
-	while (priv->autoscroll_x < -1.0) {
-	    sd->left++;
-	    priv->autoscroll_x += 1.0;
-	}
-    }
+    /* coasting runs on its own timer, see coastTimerFunc */
 
     return delay;
 }
@@ -2053,6 +2578,310 @@ HandleClickWithFingers(SynapticsParameters *para, struct SynapticsHwState *hw)
 }
 
 
+/*
+ * Check whether anybody but the driver looks at the shared memory area. A
+ * reader sleeping on the ring is noticed immediately, others through the
+ * attach count, which costs a system call and is only checked once per
+ * second.
+ */
+static Bool
+shm_has_readers(SynapticsPrivate *priv, CARD32 now)
+{
+    struct shmid_ds ds;
+
+    if (priv->synshm->waiting)
+	return TRUE;
+
+    if (TIME_DIFF(now, priv->shm_check_time) >= 0) {
+	priv->shm_readers = (shmctl(priv->shm_id, IPC_STAT, &ds) == 0 &&
+			     ds.shm_nattch > 1);
+	priv->shm_check_time = now + 1000;
+    }
+    return priv->shm_readers;
+}
+
+/*
+ * Append the hardware state to the ring in shared memory. See synaptics.h
+ * for the protocol.
+ */
+static void
+store_shm_state(SynapticsSHM *shm, const struct SynapticsHwState *hw)
+{
+    unsigned int n = shm->write_index;
+    SynapticsSHMState *s = &shm->ring[n & (SYNSHM_RING_SIZE - 1)];
+    int i;
+
+    s->seq = 2 * n + 1;
+    SYNSHM_BARRIER();
+
+    s->millis = hw->millis;
+    s->x = hw->x;
+    s->y = hw->y;
+    s->z = hw->z;
+    s->numFingers = hw->numFingers;
+    s->fingerWidth = hw->fingerWidth;
+    s->left = hw->left;
+    s->right = hw->right;
+    s->up = hw->up;
+    s->down = hw->down;
+    for (i = 0; i < 8; i++)
+	s->multi[i] = hw->multi[i];
+    s->middle = hw->middle;
+    s->guest_left = hw->guest_left;
+    s->guest_mid = hw->guest_mid;
+    s->guest_right = hw->guest_right;
+    s->guest_dx = hw->guest_dx;
+    s->guest_dy = hw->guest_dy;
+
+    SYNSHM_BARRIER();
+    s->seq = 2 * n + 2;
+    shm->write_index = n + 1;
+
+#ifdef HAVE_LINUX_FUTEX_H
+    /* read-only readers can't set waiting, so always wake */
+    shm->waiting = 0;
+    SYNSHM_FULL_BARRIER();
+    syscall(SYS_futex, &shm->write_index, FUTEX_WAKE, INT_MAX,
+	    NULL, NULL, 0);
+#endif
+}
+
+/*
+ * Events generated by one HandleState call. They are collected here and
+ * posted together by flush_events(), which also drops button events that
+ * wouldn't change the button state the server has seen.
+ */
+#define MAX_BATCH_EVENTS 32
+
+struct EventBatch {
+    int nevents;
+    int motion;				/* index of the motion event, or -1 */
+    struct {
+	int button;			/* 0 for motion */
+	Bool down;
+	int num_valuators;
+	int valuators[NUM_AXES];
+    } events[MAX_BATCH_EVENTS];
+};
+
+static void
+flush_events(LocalDevicePtr local, struct EventBatch *batch)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) (local->private);
+    int i;
+
+    for (i = 0; i < batch->nevents; i++) {
+	int button = batch->events[i].button;
+	int *v = batch->events[i].valuators;
+
+	if (button == 0) {
+	    if (batch->events[i].num_valuators == 4)
+		xf86PostMotionEvent(local->dev, 0, 0, 4, v[0], v[1], v[2], v[3]);
+	    else
+		xf86PostMotionEvent(local->dev, 0, 0, 2, v[0], v[1]);
+	} else {
+	    int mask = 1 << (button - 1);
+	    Bool down = batch->events[i].down;
+
+	    if (!down == !(priv->posted_buttons & mask))
+		continue;
+	    priv->posted_buttons ^= mask;
+	    xf86PostButtonEvent(local->dev, FALSE, button, down, 0, 0);
+	}
+    }
+    batch->nevents = 0;
+    batch->motion = -1;
+}
+
+static void
+queue_motion(LocalDevicePtr local, struct EventBatch *batch,
+	     int dx, int dy, int scroll_dy, int scroll_dx)
+{
+    int *v;
+
+    /* add to the pending motion, if there is one */
+    if (batch->motion < 0) {
+	if (batch->nevents == MAX_BATCH_EVENTS)
+	    flush_events(local, batch);
+	batch->motion = batch->nevents++;
+	batch->events[batch->motion].button = 0;
+	batch->events[batch->motion].num_valuators = 2;
+	memset(batch->events[batch->motion].valuators, 0,
+	       sizeof(batch->events[batch->motion].valuators));
+    }
+    v = batch->events[batch->motion].valuators;
+    v[0] += dx;
+    v[1] += dy;
+    v[2] += scroll_dy;
+    v[3] += scroll_dx;
+    if (v[2] || v[3])
+	batch->events[batch->motion].num_valuators = 4;
+}
+
+static void
+queue_button(LocalDevicePtr local, struct EventBatch *batch, int button, Bool down)
+{
+    if (batch->nevents == MAX_BATCH_EVENTS)
+	flush_events(local, batch);
+    batch->events[batch->nevents].button = button;
+    batch->events[batch->nevents].down = down;
+    batch->nevents++;
+}
+
+/*
+ * Coasting. The speeds in autoscroll_xspd/yspd (scroll steps per second)
+ * decrease by CoastingFriction steps per second per second, and
+ * autoscroll_x/y hold the part of a step covered so far. Instead of
+ * running HandleState at a fixed rate, the time of the next whole step is
+ * computed from the speed, and coast_timer fires just then to post it.
+ */
+#define COAST_SMOOTH_INTERVAL 20	/* ms between smooth scrolling coasting events */
+
+/* Slow down one axis over dt seconds, return the distance covered in steps */
+static double
+coast_advance(double *spd, double friction, double dt)
+{
+    double speed = fabs(*spd);
+    double dist;
+
+    if (friction > 0 && dt > speed / friction)
+	dt = speed / friction;
+    dist = speed * dt - 0.5 * friction * dt * dt;
+    speed = MAX(speed - friction * dt, 0);
+    if (*spd < 0) {
+	*spd = -speed;
+	return -dist;
+    }
+    *spd = speed;
+    return dist;
+}
+
+/* Milliseconds until the next whole step on one axis, -1 if there is none */
+static int
+coast_next_step(double spd, double pos, double friction)
+{
+    double speed = fabs(spd);
+    double dist = 1.0 - (spd > 0 ? pos : -pos);
+    double t;
+
+    if (speed == 0)
+	return -1;
+    if (friction > 0) {
+	double disc = speed * speed - 2 * friction * dist;
+	if (disc < 0)
+	    return -1;			/* stops before getting there */
+	t = (speed - sqrt(disc)) / friction;
+    } else
+	t = dist / speed;
+    return MAX((int)ceil(t * 1000), 1);
+}
+
+/* Arm coast_timer for the next step, or stop coasting if there is none */
+static void
+schedule_coasting(LocalDevicePtr local, CARD32 now)
+{
+    SynapticsPrivate *priv = (SynapticsPrivate *) (local->private);
+    SynapticsParameters *para = &priv->synpara;
+    CARD32 wakeUpTime;
+    int delay;
+
+    if (para->smooth_scrolling) {
+	delay = (priv->autoscroll_xspd || priv->autoscroll_yspd) ?
+	    COAST_SMOOTH_INTERVAL : -1;
+    } else {
+	int dx = coast_next_step(priv->autoscroll_xspd, priv->autoscroll_x,
+				 para->coasting_friction);
+	int dy = coast_next_step(priv->autoscroll_yspd, priv->autoscroll_y,
+				 para->coasting_friction);
+	delay = (dx < 0 || (dy >= 0 && dy < dx)) ? dy : dx;
+    }
+
+    if (delay < 0) {
+	DBG(7, "coasting stopped\n");
+	stop_coasting(priv);
+	return;
+    }
+    /* TimerSet runs the callback right away for a time in the past */
+    wakeUpTime = priv->coast_time + delay;
+    if (TIME_DIFF(wakeUpTime, now) <= 0)
+	wakeUpTime = now + 1;
+    priv->coast_timer = TimerSet(priv->coast_timer, TimerAbsolute,
+				 wakeUpTime, coastTimerFunc, local);
+    priv->coast_armed = TRUE;
+}
+
+static CARD32
+coastTimerFunc(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    LocalDevicePtr local = (LocalDevicePtr) (arg);
+    SynapticsPrivate *priv = (SynapticsPrivate *) (local->private);
+    SynapticsParameters *para = &priv->synpara;
+    struct EventBatch batch;
+    double dt;
+    int sigstate;
+
+    sigstate = xf86BlockSIGIO();
+
+    priv->coast_armed = FALSE;
+    if (para->touchpad_off == 1 ||
+	!(priv->autoscroll_xspd || priv->autoscroll_yspd)) {
+	stop_coasting(priv);
+	xf86UnblockSIGIO(sigstate);
+	return 0;
+    }
+
+    dt = TIME_DIFF(now, priv->coast_time) / 1000.0;
+    priv->coast_time = now;
+    priv->autoscroll_x += coast_advance(&priv->autoscroll_xspd, para->coasting_friction, dt);
+    priv->autoscroll_y += coast_advance(&priv->autoscroll_yspd, para->coasting_friction, dt);
+
+    batch.nevents = 0;
+    batch.motion = -1;
+    if (is_inside_active_area(priv, priv->hwState.x, priv->hwState.y)) {
+	if (para->smooth_scrolling) {
+	    int scroll_dx, scroll_dy;
+
+	    priv->scroll_rem_x += priv->autoscroll_x * SYN_SCROLL_INCREMENT;
+	    priv->scroll_rem_y += priv->autoscroll_y * SYN_SCROLL_INCREMENT;
+	    priv->autoscroll_x = priv->autoscroll_y = 0.0;
+	    scroll_dx = (int)priv->scroll_rem_x;
+	    scroll_dy = (int)priv->scroll_rem_y;
+	    priv->scroll_rem_x -= scroll_dx;
+	    priv->scroll_rem_y -= scroll_dy;
+	    if (scroll_dx || scroll_dy)
+		queue_motion(local, &batch, 0, 0, scroll_dy, scroll_dx);
+	} else {
+	    /* keep the up/down buttons pressed if they are */
+	    Bool up = (priv->lastButtons & 0x08) != 0;
+	    Bool down = (priv->lastButtons & 0x10) != 0;
+
+	    for (; priv->autoscroll_y >= 1.0; priv->autoscroll_y -= 1.0) {
+		queue_button(local, &batch, 5, !down);
+		queue_button(local, &batch, 5, down);
+	    }
+	    for (; priv->autoscroll_y <= -1.0; priv->autoscroll_y += 1.0) {
+		queue_button(local, &batch, 4, !up);
+		queue_button(local, &batch, 4, up);
+	    }
+	    for (; priv->autoscroll_x >= 1.0; priv->autoscroll_x -= 1.0) {
+		queue_button(local, &batch, 7, TRUE);
+		queue_button(local, &batch, 7, FALSE);
+	    }
+	    for (; priv->autoscroll_x <= -1.0; priv->autoscroll_x += 1.0) {
+		queue_button(local, &batch, 6, TRUE);
+		queue_button(local, &batch, 6, FALSE);
+	    }
+	}
+    }
+    flush_events(local, &batch);
+
+    schedule_coasting(local, now);
+
+    xf86UnblockSIGIO(sigstate);
+
+    return 0;
+}
+
 /*
  * React on changes in the hardware state. This function is called every time
  * the hardware state changes. The return value is used to specify how many
@@ -2067,41 +2896,27 @@ HandleState(LocalDevicePtr local, struct SynapticsHwState *hw)
     SynapticsParameters *para = &priv->synpara;
     int finger;
     int dx, dy, buttons, rep_buttons, id;
+    int scroll_dx = 0, scroll_dy = 0;
     edge_type edge;
     int change;
     struct ScrollData scroll;
+    struct EventBatch batch;
     int double_click, repeat_delay;
     int delay = 1000000000;
     int timeleft;
-    int i;
     Bool inside_active_area;
 
-    /* update hardware state in shared memory */
-    if (shm)
-    {
-        shm->x = hw->x;
-        shm->y = hw->y;
-        shm->z = hw->z;
-        shm->numFingers = hw->numFingers;
-        shm->fingerWidth = hw->fingerWidth;
-        shm->left = hw->left;
-        shm->right = hw->right;
-        shm->up = hw->up;
-        shm->down = hw->down;
-        for (i = 0; i < 8; i++)
-            shm->multi[i] = hw->multi[i];
-        shm->middle = hw->middle;
-        shm->guest_left = hw->guest_left;
-        shm->guest_mid = hw->guest_mid;
-        shm->guest_right = hw->guest_right;
-        shm->guest_dx = hw->guest_dx;
-        shm->guest_dy = hw->guest_dy;
-    }
+    /* update hardware state in shared memory, if anybody is watching */
+    if (shm && shm_has_readers(priv, hw->millis))
+	store_shm_state(shm, hw);
 
     /* If touchpad is switched off, we skip the whole thing and return delay */
     if (para->touchpad_off == 1)
 	return delay;
 
+    batch.nevents = 0;
+    batch.motion = -1;
+
     /* Treat the first two multi buttons as up/down for now. */
     hw->up |= hw->multi[0];
     hw->down |= hw->multi[1];
@@ -2165,6 +2980,8 @@ HandleState(LocalDevicePtr local, struct SynapticsHwState *hw)
     timeleft = HandleScrolling(priv, hw, edge, finger, &scroll);
     if (timeleft > 0)
 	delay = MIN(delay, timeleft);
+    if ((priv->autoscroll_xspd || priv->autoscroll_yspd) && !priv->coast_armed)
+	schedule_coasting(local, hw->millis);
 
     /*
      * Compensate for unequal x/y resolution. This needs to be done after
@@ -2191,7 +3008,7 @@ HandleState(LocalDevicePtr local, struct SynapticsHwState *hw)
 	int tap_mask = 1 << (priv->tap_button - 1);
 	if (priv->tap_button_state == TBS_BUTTON_DOWN_UP) {
 	    if (tap_mask != (priv->lastButtons & tap_mask)) {
-		xf86PostButtonEvent(local->dev, FALSE, priv->tap_button, TRUE, 0, 0);
+		queue_button(local, &batch, priv->tap_button, TRUE);
 		priv->lastButtons |= tap_mask;
 	    }
 	    priv->tap_button_state = TBS_BUTTON_UP;
@@ -2208,18 +3025,29 @@ HandleState(LocalDevicePtr local, struct SynapticsHwState *hw)
     if (!inside_active_area)
 	dx = dy = 0;
 
-    if (dx || dy)
-	xf86PostMotionEvent(local->dev, 0, 0, 2, dx, dy);
+    /* Smooth scrolling goes out in the same event as the motion, with the
+     * part that doesn't make a whole valuator unit kept for later. */
+    if (inside_active_area && para->smooth_scrolling) {
+	priv->scroll_rem_x += scroll.delta_x * SYN_SCROLL_INCREMENT;
+	priv->scroll_rem_y += scroll.delta_y * SYN_SCROLL_INCREMENT;
+	scroll_dx = (int)priv->scroll_rem_x;
+	scroll_dy = (int)priv->scroll_rem_y;
+	priv->scroll_rem_x -= scroll_dx;
+	priv->scroll_rem_y -= scroll_dy;
+    }
+
+    if (dx || dy || scroll_dx || scroll_dy)
+	queue_motion(local, &batch, dx, dy, scroll_dy, scroll_dx);
 
     if (priv->mid_emu_state == MBE_LEFT_CLICK)
     {
-	xf86PostButtonEvent(local->dev, FALSE, 1, 1, 0, 0);
-	xf86PostButtonEvent(local->dev, FALSE, 1, 0, 0, 0);
+	queue_button(local, &batch, 1, TRUE);
+	queue_button(local, &batch, 1, FALSE);
 	priv->mid_emu_state = MBE_OFF;
     } else if (priv->mid_emu_state == MBE_RIGHT_CLICK)
     {
-	xf86PostButtonEvent(local->dev, FALSE, 3, 1, 0, 0);
-	xf86PostButtonEvent(local->dev, FALSE, 3, 0, 0, 0);
+	queue_button(local, &batch, 3, TRUE);
+	queue_button(local, &batch, 3, FALSE);
 	priv->mid_emu_state = MBE_OFF;
     }
 
@@ -2227,7 +3055,7 @@ HandleState(LocalDevicePtr local, struct SynapticsHwState *hw)
     while (change) {
 	id = ffs(change); /* number of first set bit 1..32 is returned */
 	change &= ~(1 << (id - 1));
-	xf86PostButtonEvent(local->dev, FALSE, id, (buttons & (1 << (id - 1))), 0, 0);
+	queue_button(local, &batch, id, (buttons & (1 << (id - 1))) != 0);
     }
 
     /* Process scroll events only if coordinates are
@@ -2235,28 +3063,28 @@ HandleState(LocalDevicePtr local, struct SynapticsHwState *hw)
      */
     if (inside_active_area) {
         while (scroll.up-- > 0) {
-		xf86PostButtonEvent(local->dev, FALSE, 4, !hw->up, 0, 0);
-		xf86PostButtonEvent(local->dev, FALSE, 4, hw->up, 0, 0);
+		queue_button(local, &batch, 4, !hw->up);
+		queue_button(local, &batch, 4, hw->up);
         }
         while (scroll.down-- > 0) {
-		xf86PostButtonEvent(local->dev, FALSE, 5, !hw->down, 0, 0);
-		xf86PostButtonEvent(local->dev, FALSE, 5, hw->down, 0, 0);
+		queue_button(local, &batch, 5, !hw->down);
+		queue_button(local, &batch, 5, hw->down);
         }
         while (scroll.left-- > 0) {
-		xf86PostButtonEvent(local->dev, FALSE, 6, TRUE, 0, 0);
-		xf86PostButtonEvent(local->dev, FALSE, 6, FALSE, 0, 0);
+		queue_button(local, &batch, 6, TRUE);
+		queue_button(local, &batch, 6, FALSE);
         }
         while (scroll.right-- > 0) {
-		xf86PostButtonEvent(local->dev, FALSE, 7, TRUE, 0, 0);
-		xf86PostButtonEvent(local->dev, FALSE, 7, FALSE, 0, 0);
+		queue_button(local, &batch, 7, TRUE);
+		queue_button(local, &batch, 7, FALSE);
         }
     }
 
     if (double_click) {
 	int i;
 	for (i = 0; i < 2; i++) {
-	    xf86PostButtonEvent(local->dev, FALSE, 1, !hw->left, 0, 0);
-	    xf86PostButtonEvent(local->dev, FALSE, 1, hw->left, 0, 0);
+	    queue_button(local, &batch, 1, !hw->left);
+	    queue_button(local, &batch, 1, hw->left);
 	}
     }
 
@@ -2285,8 +3113,8 @@ HandleState(LocalDevicePtr local, struct SynapticsHwState *hw)
 	    while (change) {
 		id = ffs(change);
 		change &= ~(1 << (id - 1));
-		xf86PostButtonEvent(local->dev, FALSE, id, FALSE, 0, 0);
-		xf86PostButtonEvent(local->dev, FALSE, id, TRUE, 0, 0);
+		queue_button(local, &batch, id, FALSE);
+		queue_button(local, &batch, id, TRUE);
 	    }
 
 	    priv->nextRepeat = hw->millis + repeat_delay;
@@ -2294,6 +3122,8 @@ HandleState(LocalDevicePtr local, struct SynapticsHwState *hw)
 	}
     }
 
+    flush_events(local, &batch);
+
     /* Save old values of some state variables */
     priv->finger_state = finger;
     priv->lastButtons = buttons;
@@ -2360,6 +3190,7 @@ QueryHardware(LocalDevicePtr local)
     SynapticsPrivate *priv = (SynapticsPrivate *) local->private;
 
     priv->comm.protoBufTail = 0;
+    priv->comm.protoSync = 0;
 
     if (!priv->proto_ops->QueryHardware(local)) {
 	xf86Msg(X_PROBED, "%s: no supported touchpad found\n", local->name);
@@ -2374,11 +3205,18 @@ QueryHardware(LocalDevicePtr local)
 static void
 ScaleCoordinates(SynapticsPrivate *priv, struct SynapticsHwState *hw)
 {
-    int xCenter = (priv->synpara.left_edge + priv->synpara.right_edge) / 2;
-    int yCenter = (priv->synpara.top_edge + priv->synpara.bottom_edge) / 2;
-
+    int xCenter = priv->derived.scale_center_x;
+    int yCenter = priv->derived.scale_center_y;
+
+#ifdef FIXED_POINT_MOTION
+    hw->x = FIXED_TO_INT(FIXED_MUL(INT_TO_FIXED(hw->x - xCenter), priv->horiz_coeff_fixed) +
+			 INT_TO_FIXED(xCenter));
+    hw->y = FIXED_TO_INT(FIXED_MUL(INT_TO_FIXED(hw->y - yCenter), priv->vert_coeff_fixed) +
+			 INT_TO_FIXED(yCenter));
+#else
     hw->x = (hw->x - xCenter) * priv->horiz_coeff + xCenter;
     hw->y = (hw->y - yCenter) * priv->vert_coeff + yCenter;
+#endif
 }
 
 void
@@ -2397,4 +3235,74 @@ CalculateScalingCoeffs(SynapticsPrivate *priv)
         priv->horiz_coeff = 1;
         priv->vert_coeff = 1;
     }
+
+#ifdef FIXED_POINT_MOTION
+    priv->horiz_coeff_fixed = DOUBLE_TO_FIXED(priv->horiz_coeff);
+    priv->vert_coeff_fixed = DOUBLE_TO_FIXED(priv->vert_coeff);
+#endif
+}
+
+/*
+ * Precompute the values the input code derives from the parameters. Must
+ * be called whenever the parameters change.
+ */
+void
+CalculateDerivedParameters(SynapticsPrivate *priv)
+{
+    SynapticsParameters *para = &priv->synpara;
+    SynapticsDerivedParameters *derived = &priv->derived;
+    double half_width, half_height;
+#ifdef FIXED_POINT_MOTION
+    int i;
+#endif
+
+    derived->scale_center_x = (para->left_edge + para->right_edge) / 2;
+    derived->scale_center_y = (para->top_edge + para->bottom_edge) / 2;
+
+    derived->center_x = (para->left_edge + para->right_edge) / 2.0;
+    derived->center_y = (para->top_edge + para->bottom_edge) / 2.0;
+
+    half_width = para->right_edge - derived->center_x;
+    half_height = para->bottom_edge - derived->center_y;
+    if ((half_width > 0) && (half_height > 0)) {
+	derived->inv_half_width = 1.0 / half_width;
+	derived->inv_half_height = 1.0 / half_height;
+    } else {
+	derived->inv_half_width = 0;
+	derived->inv_half_height = 0;
+    }
+
+    /* only used for pressures strictly between min and max */
+    if (para->edge_motion_max_z > para->edge_motion_min_z)
+	derived->edge_motion_slope =
+	    (double)(para->edge_motion_max_speed - para->edge_motion_min_speed) /
+	    (para->edge_motion_max_z - para->edge_motion_min_z);
+    else
+	derived->edge_motion_slope = 0;
+
+    if (para->press_motion_max_z > para->press_motion_min_z)
+	derived->press_motion_slope =
+	    (para->press_motion_max_factor - para->press_motion_min_factor) /
+	    (para->press_motion_max_z - para->press_motion_min_z);
+    else
+	derived->press_motion_slope = 0;
+
+    if (para->accel_profile_len > 0)
+	derived->accel_profile_inv_step = 1.0 / para->accel_profile_step;
+    else
+	derived->accel_profile_inv_step = 0;
+
+#ifdef FIXED_POINT_MOTION
+    derived->min_speed_fixed = DOUBLE_TO_FIXED(para->min_speed);
+    derived->max_speed_fixed = DOUBLE_TO_FIXED(para->max_speed);
+    derived->accl_fixed = DOUBLE_TO_FIXED(para->accl);
+    derived->trackstick_speed_fixed = DOUBLE_TO_FIXED(para->trackstick_speed);
+    derived->edge_motion_slope_fixed = DOUBLE_TO_FIXED(derived->edge_motion_slope);
+    derived->press_motion_min_factor_fixed = DOUBLE_TO_FIXED(para->press_motion_min_factor);
+    derived->press_motion_max_factor_fixed = DOUBLE_TO_FIXED(para->press_motion_max_factor);
+    derived->press_motion_slope_fixed = DOUBLE_TO_FIXED(derived->press_motion_slope);
+    derived->accel_profile_inv_step_fixed = DOUBLE_TO_FIXED(derived->accel_profile_inv_step);
+    for (i = 0; i < para->accel_profile_len; i++)
+	derived->accel_profile_fixed[i] = DOUBLE_TO_FIXED(para->accel_profile[i]);
+#endif
 }
@@ -39,7 +39,23 @@
  *		Definitions
  *					structs, typedefs, #defines, enums
  *****************************************************************************/
-#define SYNAPTICS_MOVE_HISTORY	5
+#define SYNAPTICS_MOVE_HISTORY	16	/* must be a power of two */
+
+#ifdef FIXED_POINT_MOTION
+/*
+ * Q16.16 fixed point numbers, used by the pointer motion code instead of
+ * doubles when configured with --enable-fixed-point-motion.
+ */
+typedef int32_t fixed_t;
+
+#define FIXED_SHIFT		16
+#define FIXED_ONE		(1 << FIXED_SHIFT)
+#define INT_TO_FIXED(i)		((fixed_t)(i) * FIXED_ONE)
+#define DOUBLE_TO_FIXED(d)	((fixed_t)floor((d) * FIXED_ONE + 0.5))
+/* truncates towards zero, like a cast from double */
+#define FIXED_TO_INT(f)		((int)((f) / FIXED_ONE))
+#define FIXED_MUL(a, b)		((fixed_t)(((int64_t)(a) * (b)) >> FIXED_SHIFT))
+#endif
 
 typedef struct _SynapticsMoveHist
 {
@@ -121,6 +137,10 @@ typedef struct _SynapticsParameters
     Bool scroll_twofinger_horiz;	    /* Enable/disable horizontal two-finger scrolling */
     double min_speed, max_speed, accl;	    /* movement parameters */
     double trackstick_speed;		    /* trackstick mode speed */
+    int accel_profile_len;		    /* number of samples in accel_profile, 0 to use
+					       min_speed, max_speed and accl instead */
+    double accel_profile_step;		    /* finger distance per packet between two samples */
+    double accel_profile[MAX_ACCEL_PROFILE]; /* speed factors at 0, step, 2*step, ... */
     int edge_motion_min_z;		    /* finger pressure at which minimum edge motion speed is set */
     int edge_motion_max_z;		    /* finger pressure at which maximum edge motion speed is set */
     int edge_motion_min_speed;		    /* slowest setting for edge motion speed */
@@ -151,6 +171,8 @@ typedef struct _SynapticsParameters
     int palm_min_width;			    /* Palm detection width */
     int palm_min_z;			    /* Palm detection depth */
     double coasting_speed;		    /* Coasting threshold scrolling speed */
+    double coasting_friction;		    /* Number of scrolls per second per second to slow down coasting */
+    int velocity_samples;		    /* Number of packets used to estimate the finger velocity */
     int press_motion_min_z;		    /* finger pressure at which minimum pressure motion factor is applied */
     int press_motion_max_z;		    /* finger pressure at which maximum pressure motion factor is applied */
     double press_motion_min_factor;	    /* factor applied on speed when finger pressure is at minimum */
@@ -160,23 +182,58 @@ typedef struct _SynapticsParameters
     unsigned int resolution_horiz;          /* horizontal resolution of touchpad in units/mm */
     unsigned int resolution_vert;           /* vertical resolution of touchpad in units/mm */
     int area_left_edge, area_right_edge, area_top_edge, area_bottom_edge; /* area coordinates absolute */
+    Bool smooth_scrolling;		    /* Report scrolling on valuators instead of buttons */
 } SynapticsParameters;
 
 
+/*
+ * Values computed from SynapticsParameters, so the input code doesn't have
+ * to. Update with CalculateDerivedParameters() after changing parameters.
+ */
+typedef struct _SynapticsDerivedParameters
+{
+    int scale_center_x, scale_center_y;	    /* pad center used by ScaleCoordinates */
+    double center_x, center_y;		    /* exact center of the edges */
+    double inv_half_width;		    /* 1 / half the distance between the edges, */
+    double inv_half_height;		    /* 0 if the edges are not set up */
+    double edge_motion_slope;		    /* edge motion speed per unit of pressure */
+    double press_motion_slope;		    /* pressure motion factor per unit of pressure */
+    double accel_profile_inv_step;	    /* 1 / accel_profile_step */
+#ifdef FIXED_POINT_MOTION
+    /* the floating point values used by the motion code, as fixed_t */
+    fixed_t min_speed_fixed, max_speed_fixed, accl_fixed;
+    fixed_t trackstick_speed_fixed;
+    fixed_t edge_motion_slope_fixed;
+    fixed_t press_motion_min_factor_fixed, press_motion_max_factor_fixed;
+    fixed_t press_motion_slope_fixed;
+    fixed_t accel_profile_inv_step_fixed;
+    fixed_t accel_profile_fixed[MAX_ACCEL_PROFILE];
+#endif
+} SynapticsDerivedParameters;
+
 typedef struct _SynapticsPrivateRec
 {
     SynapticsParameters synpara;            /* Default parameter settings, read from
 					       the X config file */
-    SynapticsSHM *synshm;		     /* Current parameter settings. Will point to
-					        shared memory if shm_config is true */
+    SynapticsDerivedParameters derived;	    /* Values computed from synpara */
+    SynapticsSHM *synshm;		     /* Recent hardware states in shared memory,
+					        NULL unless shm_config is true */
     struct SynapticsProtocolOperations* proto_ops;
     void *proto_data;			/* protocol-specific data */
 
     struct SynapticsHwState hwState;
 
     Bool shm_config;			/* True when shared memory area allocated */
+    key_t shm_key;			/* Key of the shared memory area */
+    int shm_id;				/* and its id */
+    Bool shm_readers;			/* Somebody else has it attached */
+    CARD32 shm_check_time;		/* When to check shm_readers again */
 
     OsTimerPtr timer;			/* for up/down-button repeat, tap processing, etc */
+    Bool timer_armed;			/* timer is set to fire at timer_expires */
+    CARD32 timer_expires;
+    CARD32 timer_deadline;		/* when timerFunc has to run HandleState */
+    int last_millis;			/* time of the last HandleState run */
 
     struct CommData comm;
 
@@ -184,7 +241,9 @@ typedef struct _SynapticsPrivateRec
     int hist_index;			/* Last added entry in move_hist[] */
     int scroll_y;			/* last y-scroll position */
     int scroll_x;			/* last x-scroll position */
+    int scroll_touches;			/* contacts scroll_x/y were taken from */
     double scroll_a;			/* last angle-scroll position */
+    double scroll_rem_x, scroll_rem_y;	/* smooth scrolling not yet posted, in valuator units */
     int count_packet_finger;		/* packet counter with finger on the touchpad */
     int button_delay_millis;		/* button delay for 3rd button emulation */
     Bool prev_up;			/* Previous up button value, for double click emulation */
@@ -210,18 +269,30 @@ typedef struct _SynapticsPrivateRec
     double autoscroll_yspd;		/* Vertical coasting speed */
     double autoscroll_x;		/* Accumulated horizontal coasting scroll */
     double autoscroll_y;		/* Accumulated vertical coasting scroll */
+    OsTimerPtr coast_timer;		/* posts the coasting scroll events */
+    Bool coast_armed;			/* coast_timer is set */
+    CARD32 coast_time;			/* when autoscroll_x/y were last updated */
     int scroll_packet_count;		/* Scroll duration */
+#ifdef FIXED_POINT_MOTION
+    fixed_t frac_x, frac_y;		/* absolute -> relative fraction */
+#else
     double frac_x, frac_y;		/* absolute -> relative fraction */
+#endif
     enum MidButtonEmulation mid_emu_state;	/* emulated 3rd button */
     int repeatButtons;			/* buttons for repeat */
     int nextRepeat;			/* Time when to trigger next auto repeat event */
     int lastButtons;			/* last state of the buttons */
+    int posted_buttons;			/* buttons the server has seen pressed */
     int palm;				/* Set to true when palm detected, reset to false when
 					   palm/finger contact disappears */
     int prev_z;				/* previous z value, for palm detection */
     int avg_width;			/* weighted average of previous fingerWidth values */
     double horiz_coeff;                 /* normalization factor for x coordintes */
     double vert_coeff;                  /* normalization factor for y coordintes */
+#ifdef FIXED_POINT_MOTION
+    fixed_t horiz_coeff_fixed;		/* the same, as fixed_t */
+    fixed_t vert_coeff_fixed;
+#endif
 
     int minx, maxx, miny, maxy;         /* min/max dimensions as detected */
     int minp, maxp, minw, maxw;		/* min/max pressure and finger width as detected */
@@ -232,8 +303,11 @@ typedef struct _SynapticsPrivateRec
     Bool has_double;			/* double click detected for this device */
     Bool has_triple;			/* triple click detected for this device */
     Bool has_pressure;			/* device reports pressure */
+    Bool has_mt;			/* device reports multitouch slots */
 
     enum TouchpadModel model;          /* The detected model */
 } SynapticsPrivate;
 
+void CalculateDerivedParameters(SynapticsPrivate *priv);
+
 #endif /* _SYNAPTICSSTR_H_ */
@@ -32,11 +32,22 @@
 #include <xf86Xinput.h>
 #include <xisb.h>
 
+/* Maximum number of simultaneous contacts tracked on multitouch devices */
+#define SYNAPTICS_MAX_TOUCHES 5
+
+/* A single contact, as reported to HandleState */
+struct SynapticsTouch {
+    int x;
+    int y;
+    int z;
+};
+
 /*
  * A structure to describe the state of the touchpad hardware (buttons and pad)
  */
 struct SynapticsHwState {
-    int millis;			/* Timestamp in milliseconds */
+    int millis;			/* Timestamp in milliseconds, in the time base
+				   of GetTimeInMillis(). Set by the backend. */
     int x;			/* X position of finger */
     int y;			/* Y position of finger */
     int z;			/* Finger pressure */
@@ -56,6 +67,18 @@ struct SynapticsHwState {
     Bool guest_right;
     int  guest_dx;
     int  guest_dy;
+
+    int numTouches;		/* Number of valid entries in touches[], only
+				   set by multitouch capable backends */
+    struct SynapticsTouch touches[SYNAPTICS_MAX_TOUCHES];
+};
+
+/* Per-slot contact state of a multitouch (protocol B) device */
+struct SynapticsSlot {
+    int trackingId;		/* -1 if the slot is unused */
+    int x;
+    int y;
+    int z;
 };
 
 struct CommData {
@@ -65,12 +88,21 @@ struct CommData {
     int outOfSync;			/* How many consecutive incorrect packets we
 					   have received */
     int protoBufTail;
+    unsigned char protoRing[12];	/* Last 6 bytes, stored twice so that
+					   the window is always contiguous */
+    int protoRingHead;
+    unsigned int protoSync;		/* Bit i set: the bytes since i bytes
+					   ago are a valid packet prefix */
 
     /* Used for keeping track of partial HwState updates. */
     struct SynapticsHwState hwState;
     Bool oneFinger;
     Bool twoFingers;
     Bool threeFingers;
+
+    /* Multitouch slot state, updated incrementally by the kernel */
+    struct SynapticsSlot slots[SYNAPTICS_MAX_TOUCHES];
+    int curSlot;
 };
 
 enum SynapticsProtocol {
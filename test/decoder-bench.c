@@ -0,0 +1,694 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of the authors
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  The
+ * authors make no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Packet decoder benchmark. Large synthetic input streams are fed through
+ * the ReadHwState function of each protocol backend and the time per
+ * decoded packet is reported:
+ *
+ *   valid   well-formed packets only
+ *   noisy   a random byte inserted every 50 packets
+ *   desync  a byte dropped every 50 packets
+ *   guest   every other packet is from the guest (pass-through) device
+ *
+ * For the damaged streams, "resync" is the extra time per damaged packet
+ * compared to the valid stream, i.e. the cost of finding the next packet
+ * boundary again.
+ *
+ * The evdev streams are read from a temporary file, so their numbers
+ * include the read() calls but no kernel input layer.
+ *
+ * With -c, nothing is timed. Each stream is decoded once and the states
+ * are compared with the packets that went into it: the valid and guest
+ * streams must come out exactly. A damaged stream may lose packets and
+ * yield bogus states, within limits set per backend, and must end in
+ * sync. This is run by "make check".
+ *
+ * Usage: decoder-bench [-c] [-n packets] [-r rounds]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <xorg-server.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <xf86.h>
+#include <xf86Xinput.h>
+#include "synproto.h"
+#include "synaptics.h"
+#include "synapticsstr.h"
+#include "ps2comm.h"
+#ifdef BUILD_EVENTCOMM
+#include <linux/input.h>
+#endif
+#include "fake-symbols.h"
+
+#define DAMAGE_INTERVAL 50		/* packets between two damaged ones */
+#define READ_CHUNK 64			/* bytes delivered per read() */
+
+extern struct SynapticsProtocolOperations psaux_proto_operations;
+extern struct SynapticsProtocolOperations alps_proto_operations;
+#ifdef BUILD_EVENTCOMM
+extern struct SynapticsProtocolOperations event_proto_operations;
+#endif
+
+/* What a packet should decode to */
+struct expect {
+    Bool guest;
+    int x, y, z;			/* if !guest */
+    int guest_dx, guest_dy;		/* if guest */
+};
+
+struct stream {
+    unsigned char *data;
+    size_t len, size;
+    int packets;			/* packets written */
+    int damaged;			/* packets with an inserted/lost byte */
+    struct expect *expect;		/* one per packet */
+};
+
+struct result {
+    double seconds;			/* best of all rounds */
+    int decoded;
+};
+
+static int npackets = 200000;
+static int rounds = 5;
+static int resets;			/* QueryHardware calls */
+static Bool check;			/* -c */
+static Bool check_failed;
+static int bogus_limit, lost_limit;	/* per damaged packet, -c only */
+static struct SynapticsHwState *decoded;	/* states of the last run, -c only */
+
+/*****************************************************************************
+ *	Stream generation
+ ****************************************************************************/
+
+static void
+put_byte(struct stream *s, unsigned char b)
+{
+    if (s->len >= s->size) {
+	s->size = s->size ? s->size * 2 : 65536;
+	s->data = realloc(s->data, s->size);
+	if (!s->data) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    s->data[s->len++] = b;
+}
+
+static void
+put_bytes(struct stream *s, const unsigned char *buf, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+	put_byte(s, buf[i]);
+}
+
+static struct expect *
+next_expect(struct stream *s)
+{
+    if (!s->expect) {
+	s->expect = calloc(npackets, sizeof(*s->expect));
+	if (!s->expect) {
+	    perror("calloc");
+	    exit(1);
+	}
+    }
+    return &s->expect[s->packets];
+}
+
+static void
+expect_finger(struct stream *s, int x, int y, int z)
+{
+    struct expect *e = next_expect(s);
+
+    e->x = x;
+    e->y = y;
+    e->z = z;
+}
+
+static void
+expect_guest(struct stream *s, int dx, int dy)
+{
+    struct expect *e = next_expect(s);
+
+    e->guest = TRUE;
+    e->guest_dx = dx;
+    e->guest_dy = dy;
+}
+
+/* A finger moving in circles, with a button pressed now and then. */
+static void
+finger_pos(int i, int *x, int *y, int *z, int *buttons)
+{
+    *x = 3500 + (i * 37) % 1600 - 800;
+    *y = 3000 + (i * 23) % 1200 - 600;
+    *z = (i % 64) < 56 ? 40 + i % 50 : 0;
+    *buttons = (i % 256) < 16 ? 1 : 0;
+}
+
+static void
+ps2_newabs_packet(unsigned char *buf, int x, int y, int z, int w, int buttons)
+{
+    buf[0] = 0x80 | ((w & 0x0c) << 2) | ((w & 0x02) << 1) | (buttons & 0x03);
+    buf[1] = ((y >> 4) & 0xf0) | ((x >> 8) & 0x0f);
+    buf[2] = z;
+    buf[3] = 0xc0 | ((y >> 7) & 0x20) | ((x >> 8) & 0x10) |
+	     ((w & 0x01) << 2) | (buttons & 0x03);
+    buf[4] = x & 0xff;
+    buf[5] = y & 0xff;
+}
+
+static void
+ps2_guest_packet(unsigned char *buf, int dx, int dy, int buttons)
+{
+    buf[0] = 0x80 | 0x04;			/* w == 3 */
+    buf[1] = (buttons & 0x07) | (dx < 0 ? 0x10 : 0) | (dy < 0 ? 0x20 : 0);
+    buf[2] = 0;
+    buf[3] = 0xc0 | 0x04;
+    buf[4] = dx & 0xff;
+    buf[5] = dy & 0xff;
+}
+
+/*
+ * Build a Synaptics newabs stream. damage > 0 inserts a random byte,
+ * damage < 0 drops the last byte of every DAMAGE_INTERVAL'th packet.
+ */
+static void
+make_ps2_stream(struct stream *s, int damage, Bool guest)
+{
+    unsigned char buf[6];
+    int i, x, y, z, b;
+
+    for (i = 0; i < npackets; i++) {
+	if (guest && (i & 1)) {
+	    /* dy is never 0, so that a guest state can't pass for a finger */
+	    ps2_guest_packet(buf, (i % 7) - 3, (i % 5) + 1, (i % 32) < 4);
+	    expect_guest(s, (i % 7) - 3, -((i % 5) + 1));
+	} else {
+	    finger_pos(i, &x, &y, &z, &b);
+	    ps2_newabs_packet(buf, x, y, z, z ? 4 : 0, b);
+	    /* the driver flips the y axis of PS/2 touchpads */
+	    expect_finger(s, x, YMAX_NOMINAL + YMIN_NOMINAL - y, z);
+	}
+
+	if (damage && i % DAMAGE_INTERVAL == DAMAGE_INTERVAL - 1) {
+	    if (damage > 0) {
+		put_bytes(s, buf, 3);
+		put_byte(s, rand() & 0xff);
+		put_bytes(s, buf + 3, 3);
+	    } else
+		put_bytes(s, buf, 5);
+	    s->damaged++;
+	} else
+	    put_bytes(s, buf, 6);
+	s->packets++;
+    }
+}
+
+static void
+make_alps_stream(struct stream *s, int damage, Bool guest)
+{
+    unsigned char buf[6];
+    int i, x, y, z, b, n;
+
+    for (i = 0; i < npackets; i++) {
+	if (guest && (i & 1)) {
+	    int dx = (i % 7) - 3, dy = (i % 5) + 1;
+	    buf[0] = 0x08 | (dx < 0 ? 0x10 : 0) | (dy < 0 ? 0x20 : 0) |
+		     ((i % 32) < 4);
+	    buf[1] = dx & 0xff;
+	    buf[2] = dy & 0xff;
+	    n = 3;
+	    expect_guest(s, dx, -dy);
+	} else {
+	    finger_pos(i, &x, &y, &z, &b);
+	    x = x * 1023 / 7000;
+	    y = y * 767 / 6000;
+	    buf[0] = 0xf8 | b;
+	    buf[1] = x & 0x7f;
+	    buf[2] = (x >> 4) & 0x78;
+	    buf[3] = 0x08 | ((y >> 3) & 0x70);
+	    buf[4] = y & 0x7f;
+	    buf[5] = z & 0x7f;
+	    n = 6;
+	    /* no position without a finger */
+	    expect_finger(s, z ? x : 0, z ? y : 0, z);
+	}
+
+	if (damage && n == 6 && i % DAMAGE_INTERVAL == DAMAGE_INTERVAL - 1) {
+	    if (damage > 0) {
+		put_bytes(s, buf, 3);
+		put_byte(s, rand() & 0x7f);
+		put_bytes(s, buf + 3, 3);
+	    } else
+		put_bytes(s, buf, 5);
+	    s->damaged++;
+	} else
+	    put_bytes(s, buf, n);
+	s->packets++;
+    }
+}
+
+#ifdef BUILD_EVENTCOMM
+static void
+put_event(struct stream *s, int type, int code, int value)
+{
+    struct input_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    put_bytes(s, (unsigned char *)&ev, sizeof(ev));
+}
+
+/*
+ * Build an evdev stream. With mt, two contacts are reported in slots as
+ * well. With dropped, every DAMAGE_INTERVAL'th frame is preceded by a
+ * broken frame containing a SYN_DROPPED.
+ */
+static void
+make_event_stream(struct stream *s, Bool mt, Bool dropped)
+{
+    int i, x, y, z, b;
+
+    for (i = 0; i < npackets; i++) {
+	finger_pos(i, &x, &y, &z, &b);
+
+	if (dropped && i % DAMAGE_INTERVAL == DAMAGE_INTERVAL - 1) {
+	    put_event(s, EV_ABS, ABS_X, x);
+	    put_event(s, EV_SYN, SYN_DROPPED, 0);
+	    put_event(s, EV_ABS, ABS_Y, y);
+	    s->damaged++;
+	}
+
+	if (mt) {
+	    put_event(s, EV_ABS, ABS_MT_SLOT, 0);
+	    put_event(s, EV_ABS, ABS_MT_TRACKING_ID, z ? 1 : -1);
+	    put_event(s, EV_ABS, ABS_MT_POSITION_X, x);
+	    put_event(s, EV_ABS, ABS_MT_POSITION_Y, y);
+	    put_event(s, EV_ABS, ABS_MT_PRESSURE, z);
+	    put_event(s, EV_ABS, ABS_MT_SLOT, 1);
+	    put_event(s, EV_ABS, ABS_MT_TRACKING_ID, z ? 2 : -1);
+	    put_event(s, EV_ABS, ABS_MT_POSITION_X, x + 800);
+	    put_event(s, EV_ABS, ABS_MT_POSITION_Y, y);
+	    put_event(s, EV_ABS, ABS_MT_PRESSURE, z);
+	}
+	put_event(s, EV_ABS, ABS_X, x);
+	put_event(s, EV_ABS, ABS_Y, y);
+	put_event(s, EV_ABS, ABS_PRESSURE, z);
+	put_event(s, EV_ABS, ABS_TOOL_WIDTH, 5);
+	put_event(s, EV_KEY, mt ? BTN_TOOL_DOUBLETAP : BTN_TOOL_FINGER, z != 0);
+	put_event(s, EV_KEY, BTN_LEFT, b);
+	put_event(s, EV_SYN, SYN_REPORT, 0);
+	expect_finger(s, x, y, z);
+	s->packets++;
+    }
+}
+#endif
+
+static void
+free_stream(struct stream *s)
+{
+    free(s->data);
+    free(s->expect);
+    memset(s, 0, sizeof(*s));
+}
+
+/*****************************************************************************
+ *	Benchmark
+ ****************************************************************************/
+
+static Bool
+BenchQueryHardware(LocalDevicePtr local)
+{
+    resets++;
+    return TRUE;
+}
+
+static double
+get_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static LocalDevicePtr
+new_device(struct SynapticsProtocolOperations *ops)
+{
+    LocalDevicePtr local;
+    SynapticsPrivate *priv;
+
+    local = calloc(1, sizeof(*local));
+    priv = calloc(1, sizeof(*priv));
+    if (!local || !priv) {
+	perror("calloc");
+	exit(1);
+    }
+    local->name = "bench";
+    local->private = priv;
+    local->fd = -1;
+    priv->proto_ops = ops;
+    priv->synpara.finger_high = 30;
+    priv->comm.buffer = XisbNew(-1, 200);
+    return local;
+}
+
+static void
+free_device(LocalDevicePtr local)
+{
+    SynapticsPrivate *priv = local->private;
+
+    XisbFree(priv->comm.buffer);
+    free(priv->proto_data);
+    free(priv);
+    free(local);
+}
+
+/*
+ * Decode the whole stream rounds times through ops->ReadHwState and return
+ * the best time. For evdev, fd is the file holding the stream, otherwise
+ * the stream is served by XisbRead() in READ_CHUNK sized pieces.
+ */
+static struct result
+run(LocalDevicePtr local, struct SynapticsProtocolOperations *ops,
+    const struct stream *s, int fd)
+{
+    SynapticsPrivate *priv = local->private;
+    struct SynapticsHwState hw;
+    struct result res;
+    double t0, t;
+    int r, n = 0;
+
+    res.seconds = 0;
+    for (r = 0; r < rounds; r++) {
+	if (fd >= 0)
+	    lseek(fd, 0, SEEK_SET);
+	else
+	    fake_set_input(s->data, s->len, READ_CHUNK);
+	/* don't start in the middle of the last stream's packet */
+	priv->comm.protoBufTail = 0;
+	priv->comm.protoRingHead = 0;
+	priv->comm.protoSync = 0;
+	priv->comm.outOfSync = 0;
+	priv->comm.lastByte = 0;
+	n = 0;
+
+	t0 = get_time();
+	do {
+	    while (ops->ReadHwState(local, ops, &priv->comm, &hw)) {
+		if (check && n < 2 * s->packets)
+		    decoded[n] = hw;
+		n++;
+	    }
+	} while (fd < 0 && fake_input_left());
+	t = get_time() - t0;
+
+	if (r == 0 || t < res.seconds)
+	    res.seconds = t;
+    }
+
+    res.decoded = n;
+    return res;
+}
+
+static Bool
+matches(const struct SynapticsHwState *hw, const struct expect *e)
+{
+    if (e->guest)
+	return hw->guest_dx == e->guest_dx && hw->guest_dy == e->guest_dy;
+    return hw->x == e->x && hw->y == e->y && hw->z == e->z &&
+	hw->guest_dx == 0 && hw->guest_dy == 0;
+}
+
+/*
+ * Compare the decoded states with the expected ones, in order. A state
+ * that matches none of the packets still to come is bogus.
+ */
+static void
+check_stream(const char *name, const struct stream *s, int n)
+{
+    int i, j = 0, k, bogus = 0, lost;
+    Bool synced;
+
+    for (i = 0; i < n && i < 2 * s->packets; i++) {
+	for (k = j; k < s->packets; k++)
+	    if (matches(&decoded[i], &s->expect[k]))
+		break;
+	if (k == s->packets)
+	    bogus++;
+	else
+	    j = k + 1;
+    }
+    lost = s->packets - (n - bogus);
+    /* the last damaged packet is at most DAMAGE_INTERVAL from the end */
+    synced = j > s->packets - DAMAGE_INTERVAL;
+
+    if (!synced || bogus > bogus_limit * s->damaged ||
+	lost > lost_limit * s->damaged) {
+	printf("FAIL: %s: %d of %d packets lost, %d bogus states%s\n",
+	       name, lost, s->packets, bogus, synced ? "" : ", out of sync");
+	check_failed = TRUE;
+    } else
+	printf("PASS: %s\n", name);
+}
+
+/*
+ * The resync cost is the time spent on top of what the valid stream
+ * needs for the same number of bytes, per damaged packet.
+ */
+static void
+report(const char *name, const struct stream *s, struct result res,
+       size_t base_len, const struct result *base)
+{
+    if (check) {
+	check_stream(name, s, res.decoded);
+	return;
+    }
+    printf("%-16s %8d %8d %8.1f", name, s->packets, res.decoded,
+	   res.decoded ? res.seconds * 1e9 / res.decoded : 0.0);
+    if (s->damaged) {
+	double expected = base->seconds * s->len / base_len;
+	printf(" %10.1f", (res.seconds - expected) * 1e9 / s->damaged);
+    }
+    printf("\n");
+}
+
+static void
+bench_ps2(void)
+{
+    struct SynapticsProtocolOperations ops = psaux_proto_operations;
+    struct SynapticsHwInfo *synhw;
+    struct result base, res;
+    size_t base_len = 0;
+    struct stream s;
+    LocalDevicePtr local;
+    const char *names[] = { "valid", "noisy", "desync", "guest" };
+    int damage[] = { 0, 1, -1, 0 };
+    int i;
+
+    /* Resets requested by the decoder are counted, not performed */
+    ops.QueryHardware = BenchQueryHardware;
+
+    /* Only bytes 0 and 3 are checked, so a damaged packet and the one
+     * after it can pass for valid ones. The ring finds the next packet
+     * boundary within a packet or two. */
+    bogus_limit = 2;
+    lost_limit = 3;
+
+    local = new_device(&ops);
+    synhw = calloc(1, sizeof(*synhw));
+    synhw->model_id = 1 << 7;				/* newabs */
+    synhw->capabilities = (1 << 23) | (1 << 1) | (1 << 0);
+    synhw->hasGuest = TRUE;
+    ps2_synaptics_select_decoder(synhw);
+    ((SynapticsPrivate *)local->private)->proto_data = synhw;
+
+    for (i = 0; i < 4; i++) {
+	char name[32];
+
+	memset(&s, 0, sizeof(s));
+	make_ps2_stream(&s, damage[i], i == 3);
+	res = run(local, &ops, &s, -1);
+	if (i == 0) {
+	    base = res;
+	    base_len = s.len;
+	}
+	snprintf(name, sizeof(name), "ps2 %s", names[i]);
+	report(name, &s, res, base_len, &base);
+	free_stream(&s);
+    }
+    free_device(local);
+}
+
+static void
+bench_alps(void)
+{
+    struct SynapticsProtocolOperations *ops = &alps_proto_operations;
+    struct result base, res;
+    size_t base_len = 0;
+    struct stream s;
+    LocalDevicePtr local;
+    const char *names[] = { "valid", "noisy", "desync", "guest" };
+    int damage[] = { 0, 1, -1, 0 };
+    int i;
+
+    /* Only the first byte of a packet is checked, and on a bad packet the
+     * rest of the read is discarded. Until a read starts on a packet
+     * boundary again, stray bytes can pass for 3 byte guest packets. */
+    bogus_limit = 5;
+    lost_limit = 2 * READ_CHUNK / 6;
+
+    local = new_device(ops);
+    for (i = 0; i < 4; i++) {
+	char name[32];
+
+	memset(&s, 0, sizeof(s));
+	make_alps_stream(&s, damage[i], i == 3);
+	res = run(local, ops, &s, -1);
+	if (i == 0) {
+	    base = res;
+	    base_len = s.len;
+	}
+	snprintf(name, sizeof(name), "alps %s", names[i]);
+	report(name, &s, res, base_len, &base);
+	free_stream(&s);
+    }
+    free_device(local);
+}
+
+#ifdef BUILD_EVENTCOMM
+static void
+bench_event(void)
+{
+    struct SynapticsProtocolOperations *ops = &event_proto_operations;
+    struct result base, res;
+    size_t base_len = 0;
+    struct stream s;
+    LocalDevicePtr local;
+    SynapticsPrivate *priv;
+    const char *names[] = { "valid", "mt", "dropped" };
+    char path[] = "/tmp/decoder-bench.XXXXXX";
+    int i, fd;
+
+    /* The frame after a SYN_DROPPED is replaced by the state read back
+     * with ioctls, which fail on a plain file */
+    bogus_limit = 1;
+    lost_limit = 1;
+
+    local = new_device(ops);
+    priv = local->private;
+    priv->has_pressure = TRUE;
+
+    for (i = 0; i < 3; i++) {
+	char name[32];
+
+	memset(&s, 0, sizeof(s));
+	make_event_stream(&s, i == 1, i == 2);
+
+	fd = mkstemp(path);
+	if (fd < 0 || write(fd, s.data, s.len) != (ssize_t)s.len) {
+	    perror(path);
+	    exit(1);
+	}
+	unlink(path);
+	strcpy(path + strlen(path) - 6, "XXXXXX");
+
+	local->fd = fd;
+	priv->has_mt = (i == 1);
+	ops->DeviceOnHook(local, &priv->synpara);
+	res = run(local, ops, &s, fd);
+	if (i == 0) {
+	    base = res;
+	    base_len = s.len;
+	}
+	snprintf(name, sizeof(name), "evdev %s", names[i]);
+	report(name, &s, res, base_len, &base);
+
+	close(fd);
+	free_stream(&s);
+    }
+    free_device(local);
+}
+#endif
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: decoder-bench [-c] [-n packets] [-r rounds]\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "cn:r:")) != -1) {
+	switch (c) {
+	case 'c':
+	    check = TRUE;
+	    break;
+	case 'n':
+	    npackets = atoi(optarg);
+	    break;
+	case 'r':
+	    rounds = atoi(optarg);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (npackets <= 0 || rounds <= 0 || optind != argc)
+	usage();
+
+    srand(1);
+    if (check) {
+	rounds = 1;
+	decoded = calloc(2 * npackets, sizeof(*decoded));
+	if (!decoded) {
+	    perror("calloc");
+	    exit(1);
+	}
+    } else
+	printf("%-16s %8s %8s %8s %10s\n",
+	       "stream", "packets", "decoded", "ns/pkt", "resync ns");
+    bench_ps2();
+    bench_alps();
+#ifdef BUILD_EVENTCOMM
+    bench_event();
+#endif
+    if (resets && !check)
+	printf("%d touchpad resets requested\n", resets);
+
+    return check_failed ? 1 : 0;
+}
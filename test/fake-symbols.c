@@ -0,0 +1,496 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of the authors
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  The
+ * authors make no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <xorg-server.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <xf86.h>
+#include <xf86_OSproc.h>
+#include <xf86Xinput.h>
+#include <xisb.h>
+#include <exevents.h>
+#include "fake-symbols.h"
+
+CARD32 fake_time;
+FILE *fake_event_file;
+unsigned long fake_event_count;
+
+/*****************************************************************************
+ *	Options
+ ****************************************************************************/
+
+#define FAKE_MAX_OPTIONS 64
+
+static struct {
+    char *name;
+    char *value;
+} fake_options[FAKE_MAX_OPTIONS];
+static int fake_noptions;
+
+void
+fake_set_option(const char *name, const char *value)
+{
+    int i;
+
+    for (i = 0; i < fake_noptions; i++) {
+	if (!strcasecmp(fake_options[i].name, name)) {
+	    free(fake_options[i].value);
+	    fake_options[i].value = strdup(value);
+	    return;
+	}
+    }
+    if (fake_noptions >= FAKE_MAX_OPTIONS) {
+	fprintf(stderr, "too many options, ignoring %s\n", name);
+	return;
+    }
+    fake_options[fake_noptions].name = strdup(name);
+    fake_options[fake_noptions].value = strdup(value);
+    fake_noptions++;
+}
+
+void
+fake_clear_options(void)
+{
+    while (fake_noptions > 0) {
+	fake_noptions--;
+	free(fake_options[fake_noptions].name);
+	free(fake_options[fake_noptions].value);
+    }
+}
+
+static const char *
+fake_find_option(const char *name)
+{
+    int i;
+
+    for (i = 0; i < fake_noptions; i++)
+	if (!strcasecmp(fake_options[i].name, name))
+	    return fake_options[i].value;
+    return NULL;
+}
+
+char *
+xf86FindOptionValue(pointer options, const char *name)
+{
+    return (char *)fake_find_option(name);
+}
+
+pointer
+xf86ReplaceStrOption(pointer optlist, const char *name, const char *val)
+{
+    fake_set_option(name, val);
+    return optlist;
+}
+
+int
+xf86SetIntOption(pointer optlist, const char *name, int deflt)
+{
+    const char *val = fake_find_option(name);
+
+    return val ? atoi(val) : deflt;
+}
+
+double
+xf86SetRealOption(pointer optlist, const char *name, double deflt)
+{
+    const char *val = fake_find_option(name);
+
+    return val ? atof(val) : deflt;
+}
+
+int
+xf86SetBoolOption(pointer optlist, const char *name, int deflt)
+{
+    const char *val = fake_find_option(name);
+
+    if (!val)
+	return deflt;
+    return (!strcasecmp(val, "on") || !strcasecmp(val, "true") ||
+	    !strcasecmp(val, "yes") || atoi(val) != 0);
+}
+
+void
+xf86CollectInputOptions(InputInfoPtr pInfo, const char **defaultOpts,
+			pointer extraOpts)
+{
+}
+
+void
+xf86OptionListReport(pointer parm)
+{
+}
+
+void
+xf86ProcessCommonOptions(InputInfoPtr pInfo, pointer options)
+{
+}
+
+/*****************************************************************************
+ *	Timers
+ ****************************************************************************/
+
+struct _OsTimer {
+    struct _OsTimer *next;
+    Bool armed;
+    CARD32 expires;
+    OsTimerCallback callback;
+    pointer arg;
+};
+
+static struct _OsTimer *fake_timers;
+
+CARD32
+GetTimeInMillis(void)
+{
+    return fake_time;
+}
+
+OsTimerPtr
+TimerSet(OsTimerPtr timer, int flags, CARD32 millis,
+	 OsTimerCallback func, pointer arg)
+{
+    if (!timer) {
+	timer = calloc(1, sizeof(*timer));
+	if (!timer)
+	    return NULL;
+	timer->next = fake_timers;
+	fake_timers = timer;
+    }
+    timer->armed = FALSE;
+    timer->callback = func;
+    timer->arg = arg;
+    if (!millis)
+	return timer;
+    if (!(flags & TimerAbsolute))
+	millis += fake_time;
+    timer->expires = millis;
+    timer->armed = TRUE;
+    return timer;
+}
+
+void
+TimerCancel(OsTimerPtr timer)
+{
+    if (timer)
+	timer->armed = FALSE;
+}
+
+void
+TimerFree(OsTimerPtr timer)
+{
+    struct _OsTimer **t;
+
+    for (t = &fake_timers; *t; t = &(*t)->next) {
+	if (*t == timer) {
+	    *t = timer->next;
+	    free(timer);
+	    return;
+	}
+    }
+}
+
+void
+fake_run_timers(CARD32 now)
+{
+    struct _OsTimer *t, *next;
+    CARD32 millis;
+
+    for (;;) {
+	next = NULL;
+	for (t = fake_timers; t; t = t->next) {
+	    if (!t->armed || (int)(t->expires - now) > 0)
+		continue;
+	    if (!next || (int)(t->expires - next->expires) < 0)
+		next = t;
+	}
+	if (!next)
+	    break;
+
+	next->armed = FALSE;
+	if ((int)(next->expires - fake_time) > 0)
+	    fake_time = next->expires;
+	millis = next->callback(next, fake_time, next->arg);
+	if (millis)
+	    TimerSet(next, 0, millis, next->callback, next->arg);
+    }
+    fake_time = now;
+}
+
+int
+xf86BlockSIGIO(void)
+{
+    return 0;
+}
+
+void
+xf86UnblockSIGIO(int wasset)
+{
+}
+
+/*****************************************************************************
+ *	Memory
+ ****************************************************************************/
+
+pointer
+Xcalloc(unsigned long amount)
+{
+    return calloc(1, amount);
+}
+
+void
+Xfree(pointer ptr)
+{
+    free(ptr);
+}
+
+/*****************************************************************************
+ *	Messages
+ ****************************************************************************/
+
+void
+xf86Msg(MessageType type, const char *format, ...)
+{
+}
+
+void
+xf86MsgVerb(MessageType type, int verb, const char *format, ...)
+{
+}
+
+void
+xf86ErrorFVerb(int verb, const char *format, ...)
+{
+}
+
+void
+ErrorF(const char *format, ...)
+{
+}
+
+/*****************************************************************************
+ *	Events
+ ****************************************************************************/
+
+void
+xf86PostMotionEvent(DeviceIntPtr device, int is_absolute, int first_valuator,
+		    int num_valuators, ...)
+{
+    va_list args;
+    int i;
+
+    fake_event_count++;
+    if (!fake_event_file)
+	return;
+
+    fprintf(fake_event_file, "%u motion", (unsigned int)fake_time);
+    va_start(args, num_valuators);
+    for (i = 0; i < num_valuators; i++)
+	fprintf(fake_event_file, " %d", va_arg(args, int));
+    va_end(args);
+    fprintf(fake_event_file, "\n");
+}
+
+void
+xf86PostButtonEvent(DeviceIntPtr device, int is_absolute, int button,
+		    int is_down, int first_valuator, int num_valuators, ...)
+{
+    fake_event_count++;
+    if (!fake_event_file)
+	return;
+
+    fprintf(fake_event_file, "%u button %d %s\n", (unsigned int)fake_time,
+	    button, is_down ? "down" : "up");
+}
+
+/*****************************************************************************
+ *	Device input
+ ****************************************************************************/
+
+static const unsigned char *fake_input;
+static size_t fake_input_len, fake_input_pos;
+static size_t fake_input_chunk, fake_input_stop;
+
+void
+fake_set_input(const unsigned char *data, size_t len, size_t chunk)
+{
+    fake_input = data;
+    fake_input_len = len;
+    fake_input_pos = 0;
+    fake_input_chunk = chunk;
+    fake_input_stop = chunk ? chunk : len;
+}
+
+size_t
+fake_input_left(void)
+{
+    return fake_input_len - fake_input_pos;
+}
+
+XISBuffer *
+XisbNew(int fd, xisbscount size)
+{
+    return calloc(1, 1);
+}
+
+void
+XisbFree(XISBuffer *b)
+{
+    free(b);
+}
+
+int
+XisbRead(XISBuffer *b)
+{
+    if (fake_input_pos >= fake_input_len)
+	return -1;
+    if (fake_input_pos >= fake_input_stop) {
+	/* end of this read(), the next chunk arrives with the next call */
+	fake_input_stop += fake_input_chunk;
+	return -1;
+    }
+    return fake_input[fake_input_pos++];
+}
+
+int
+xf86WaitForInput(int fd, int timeout)
+{
+    return fake_input_left() ? 1 : 0;
+}
+
+int
+xf86ReadSerial(int fd, void *buf, int count)
+{
+    return -1;
+}
+
+int
+xf86WriteSerial(int fd, const void *buf, int count)
+{
+    return count;
+}
+
+int
+xf86FlushInput(int fd)
+{
+    return 0;
+}
+
+int
+xf86OpenSerial(pointer options)
+{
+    return -1;
+}
+
+int
+xf86CloseSerial(int fd)
+{
+    return 0;
+}
+
+/*****************************************************************************
+ *	Device setup, not used by the test programs
+ ****************************************************************************/
+
+InputInfoPtr
+xf86AllocateInput(InputDriverPtr drv, int flags)
+{
+    return NULL;
+}
+
+void
+xf86DeleteInput(InputInfoPtr pInp, int flags)
+{
+}
+
+void
+xf86AddInputDriver(InputDriverPtr driver, pointer module, int flags)
+{
+}
+
+void
+xf86AddEnabledDevice(InputInfoPtr pInfo)
+{
+}
+
+void
+xf86RemoveEnabledDevice(InputInfoPtr pInfo)
+{
+}
+
+Bool
+InitPointerDeviceStruct(DevicePtr device, CARD8 *map, int numButtons,
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 7
+			Atom *btn_labels,
+#endif
+			PtrCtrlProcPtr controlProc, int numMotionEvents,
+			int numAxes
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 7
+			, Atom *axes_labels
+#endif
+			)
+{
+    return TRUE;
+}
+
+int
+GetMotionHistorySize(void)
+{
+    return 0;
+}
+
+void
+xf86InitValuatorAxisStruct(DeviceIntPtr dev, int axnum,
+#if GET_ABI_MAJOR(ABI_XINPUT_VERSION) >= 7
+			   Atom label,
+#endif
+			   int minval, int maxval, int resolution,
+			   int min_res, int max_res)
+{
+}
+
+void
+xf86InitValuatorDefaults(DeviceIntPtr dev, int axnum)
+{
+}
+
+Atom
+XIGetKnownProperty(char *name)
+{
+    return None;
+}
+
+long
+XIRegisterPropertyHandler(DeviceIntPtr dev,
+			  int (*SetProperty) (DeviceIntPtr dev, Atom property,
+					      XIPropertyValuePtr prop,
+					      BOOL checkonly),
+			  int (*GetProperty) (DeviceIntPtr dev, Atom property),
+			  int (*DeleteProperty) (DeviceIntPtr dev, Atom property))
+{
+    return 0;
+}
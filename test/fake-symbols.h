@@ -0,0 +1,53 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of the authors
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  The
+ * authors make no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Stand-ins for the X server functions used by the driver, so that parts
+ * of it can be run by the offline test programs without a server.
+ */
+
+#ifndef _FAKE_SYMBOLS_H_
+#define _FAKE_SYMBOLS_H_
+
+#include <stdio.h>
+
+/* Emulated server time, returned by GetTimeInMillis() */
+extern CARD32 fake_time;
+
+/* Posted motion and button events are written here, unless NULL */
+extern FILE *fake_event_file;
+extern unsigned long fake_event_count;
+
+/* Options returned by the xf86Set*Option() functions */
+void fake_set_option(const char *name, const char *value);
+void fake_clear_options(void);
+
+/* Fire all timers that expire at or before now, in order */
+void fake_run_timers(CARD32 now);
+
+/*
+ * Bytes returned by XisbRead(). With chunk != 0, XisbRead() returns -1
+ * after every chunk bytes, as if the data arrived in separate reads.
+ */
+void fake_set_input(const unsigned char *data, size_t len, size_t chunk);
+size_t fake_input_left(void);
+
+#endif /* _FAKE_SYMBOLS_H_ */
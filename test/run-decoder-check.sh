@@ -0,0 +1,7 @@
+#!/bin/sh
+#
+# Decode synthetic packet streams with every protocol backend and check
+# the decoded states against the packets, see decoder-bench.c. The
+# benchmark itself is run with "make bench".
+
+exec ./decoder-bench -c -n 5000
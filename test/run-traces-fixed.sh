@@ -0,0 +1,7 @@
+#!/bin/sh
+#
+# Replay the traces with the fixed point motion code. Its rounding differs
+# slightly from the floating point code the .events files were made with,
+# so motion events may be off by one.
+
+REPLAY=./trace-replay-fixed TOLERANCE=1 exec "${srcdir:-.}/run-traces.sh"
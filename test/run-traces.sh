@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# Replay every trace in traces/ and compare the posted events with the
+# matching .events file. To update the expected output after an
+# intentional behaviour change:
+#   ./trace-replay traces/foo.trace > traces/foo.events
+#
+# REPLAY selects the replay program. With TOLERANCE=n, motion events may
+# be off by up to n in each axis, everything else must match exactly.
+
+srcdir=${srcdir:-.}
+REPLAY=${REPLAY:-./trace-replay}
+TOLERANCE=${TOLERANCE:-0}
+status=0
+
+compare() {
+    if [ "$TOLERANCE" = 0 ]; then
+	diff -u "$1" "$2"
+	return
+    fi
+
+    if [ `wc -l < "$1"` -ne `wc -l < "$2"` ]; then
+	diff -u "$1" "$2"
+	return 1
+    fi
+
+    paste -d '|' "$1" "$2" | awk -F '|' -v tol="$TOLERANCE" '
+	function abs(v) { return v < 0 ? -v : v }
+	{
+	    n = split($1, a, " ")
+	    if (split($2, b, " ") != n) { bad = 1; print NR ": " $0; next }
+	    for (i = 1; i <= n; i++) {
+		if (a[i] == b[i])
+		    continue
+		if (a[2] != "motion" || i < 3 || abs(a[i] - b[i]) > tol) {
+		    bad = 1
+		    print NR ": " $0
+		    next
+		}
+	    }
+	}
+	END { exit bad }'
+}
+
+for trace in "$srcdir"/traces/*.trace; do
+    expected="${trace%.trace}.events"
+    name=`basename "$trace" .trace`
+
+    if $REPLAY "$trace" > "$name.out" &&
+       compare "$expected" "$name.out"; then
+	echo "PASS: $name"
+	rm -f "$name.out"
+    else
+	echo "FAIL: $name"
+	status=1
+    fi
+done
+
+exit $status
@@ -0,0 +1,300 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of the authors
+ * not be used in advertising or publicity pertaining to distribution
+ * of the software without specific, written prior permission.  The
+ * authors make no representations about the suitability of this software
+ * for any purpose.  It is provided "as is" without express or implied
+ * warranty.
+ *
+ * THE AUTHORS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS
+ * OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Replay a recorded hardware state trace through the gesture engine
+ * (HandleState and friends) and print the X events it posts. Timers are
+ * emulated, so tap timeouts, coasting and button repeat behave as on a
+ * live server.
+ *
+ * The trace is the output of "synclient -m". Lines that do not parse,
+ * like the column headers, are skipped. For multitouch devices, the
+ * individual contacts can follow the guest columns, as x y z each.
+ * synclient doesn't print them, they have to be added by hand. Driver options can be given in
+ * the trace as comments, in xorg.conf syntax:
+ *   # Option "TapButton1" "1"
+ *
+ * Usage: trace-replay [-o Name=Value]... [-b count] trace
+ *   -o  set a driver option, overriding the trace
+ *   -b  benchmark: replay the trace count times without printing events
+ *       and report the packet rate
+ */
+
+/* The gesture engine is static, so pull in the whole driver. */
+#include "synaptics.c"
+
+#include <sys/time.h>
+#include "fake-symbols.h"
+
+/* The property code is not needed for replay */
+void
+InitDeviceProperties(LocalDevicePtr local)
+{
+}
+
+int
+SetProperty(DeviceIntPtr dev, Atom property, XIPropertyValuePtr prop,
+	    BOOL checkonly)
+{
+    return Success;
+}
+
+static struct SynapticsHwState *trace;
+static int trace_len;
+static int trace_pos;			/* next state to hand out */
+static int trace_end;			/* ReadHwState stops here */
+static CARD32 trace_offset;		/* added to all timestamps */
+
+static Bool
+ReplayReadHwState(LocalDevicePtr local,
+		  struct SynapticsProtocolOperations *proto_ops,
+		  struct CommData *comm, struct SynapticsHwState *hwRet)
+{
+    if (trace_pos >= trace_end)
+	return FALSE;
+    *hwRet = trace[trace_pos++];
+    hwRet->millis += trace_offset;
+    return TRUE;
+}
+
+static Bool
+ReplayQueryHardware(LocalDevicePtr local)
+{
+    return TRUE;
+}
+
+static Bool
+ReplayAutoDevProbe(LocalDevicePtr local)
+{
+    return FALSE;
+}
+
+static struct SynapticsProtocolOperations replay_proto_operations = {
+    NULL,
+    NULL,
+    ReplayQueryHardware,
+    ReplayReadHwState,
+    ReplayAutoDevProbe,
+    NULL /* ReadDevDimensions */
+};
+
+static void
+add_state(const struct SynapticsHwState *hw)
+{
+    static int size;
+
+    if (trace_len >= size) {
+	size = size ? size * 2 : 1024;
+	trace = realloc(trace, size * sizeof(*trace));
+	if (!trace) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    trace[trace_len++] = *hw;
+}
+
+static Bool
+read_trace(const char *filename)
+{
+    FILE *f;
+    char line[256], name[64], value[64], multi[16];
+    struct SynapticsHwState hw;
+    struct SynapticsTouch *touch;
+    double t;
+    int i, n, len;
+
+    f = fopen(filename, "r");
+    if (!f) {
+	perror(filename);
+	return FALSE;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+	if (sscanf(line, "# Option \"%63[^\"]\" \"%63[^\"]\"", name, value) == 2) {
+	    /* command line options take precedence */
+	    if (!xf86FindOptionValue(NULL, name))
+		fake_set_option(name, value);
+	    continue;
+	}
+
+	memset(&hw, 0, sizeof(hw));
+	if (sscanf(line, "%lf %d %d %d %d %d %d %d %d %d %d %8s %d %d %d %d %d%n",
+		   &t, &hw.x, &hw.y, &hw.z, &hw.numFingers, &hw.fingerWidth,
+		   &hw.left, &hw.right, &hw.up, &hw.down, &hw.middle, multi,
+		   &hw.guest_left, &hw.guest_mid, &hw.guest_right,
+		   &hw.guest_dx, &hw.guest_dy, &len) != 17)
+	    continue;
+	for (i = 0; i < 8 && multi[i]; i++)
+	    hw.multi[i] = (multi[i] == '1');
+	for (n = len; hw.numTouches < SYNAPTICS_MAX_TOUCHES; n += len) {
+	    touch = &hw.touches[hw.numTouches];
+	    if (sscanf(line + n, "%d %d %d%n",
+		       &touch->x, &touch->y, &touch->z, &len) != 3)
+		break;
+	    hw.numTouches++;
+	}
+	hw.millis = (int)(t * 1000 + 0.5);
+	add_state(&hw);
+    }
+
+    fclose(f);
+    return TRUE;
+}
+
+static LocalDevicePtr
+new_device(void)
+{
+    static DeviceIntRec dev;
+    LocalDevicePtr local;
+    SynapticsPrivate *priv;
+
+    local = calloc(1, sizeof(*local));
+    priv = calloc(1, sizeof(*priv));
+    if (!local || !priv) {
+	perror("calloc");
+	exit(1);
+    }
+
+    local->name = "trace";
+    local->dev = &dev;
+    local->private = priv;
+    local->fd = -1;
+    dev.public.devicePrivate = local;
+
+    priv->proto_ops = &replay_proto_operations;
+    priv->timer = TimerSet(NULL, 0, 0, NULL, NULL);
+    priv->coast_timer = TimerSet(NULL, 0, 0, NULL, NULL);
+    priv->tap_state = TS_START;
+    priv->tap_button_state = TBS_BUTTON_UP;
+
+    set_default_parameters(local);
+    CalculateScalingCoeffs(priv);
+
+    return local;
+}
+
+static void
+free_device(LocalDevicePtr local)
+{
+    SynapticsPrivate *priv = local->private;
+
+    TimerFree(priv->timer);
+    TimerFree(priv->coast_timer);
+    free(priv);
+    free(local);
+}
+
+/*
+ * Feed the trace to the driver, one packet per ReadInput call, and fire
+ * the timers in between. After the last packet, pending timers are run
+ * for another 5 seconds.
+ */
+static void
+replay(LocalDevicePtr local)
+{
+    CARD32 millis = trace_offset;
+
+    for (trace_pos = 0; trace_pos < trace_len; ) {
+	millis = trace[trace_pos].millis + trace_offset;
+	fake_run_timers(millis);
+	trace_end = trace_pos + 1;
+	ReadInput(local);
+    }
+    fake_run_timers(millis + 5000);
+}
+
+static double
+get_time(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: trace-replay [-o Name=Value]... [-b count] trace\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    LocalDevicePtr local;
+    int c, i, bench = 0;
+    char *eq;
+
+    while ((c = getopt(argc, argv, "o:b:")) != -1) {
+	switch (c) {
+	case 'o':
+	    eq = strchr(optarg, '=');
+	    if (!eq)
+		usage();
+	    *eq = '\0';
+	    fake_set_option(optarg, eq + 1);
+	    break;
+	case 'b':
+	    bench = atoi(optarg);
+	    if (bench <= 0)
+		usage();
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc - 1)
+	usage();
+
+    if (!read_trace(argv[optind]))
+	return 1;
+    if (trace_len == 0) {
+	fprintf(stderr, "%s: no hardware states found\n", argv[optind]);
+	return 1;
+    }
+
+    if (!bench) {
+	fake_event_file = stdout;
+	local = new_device();
+	replay(local);
+	free_device(local);
+    } else {
+	CARD32 span = trace[trace_len - 1].millis - trace[0].millis + 10000;
+	double t0, t1;
+
+	local = new_device();
+	t0 = get_time();
+	for (i = 0; i < bench; i++) {
+	    trace_offset = i * span;
+	    replay(local);
+	}
+	t1 = get_time();
+	free_device(local);
+
+	printf("%d packets, %lu events in %.3f s: %.0f packets/s\n",
+	       trace_len * bench, fake_event_count, t1 - t0,
+	       trace_len * bench / (t1 - t0));
+    }
+
+    return 0;
+}
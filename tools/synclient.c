@@ -33,11 +33,16 @@
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
-#include <sys/time.h>
 #include <unistd.h>
 #include <string.h>
 #include <stddef.h>
 #include <math.h>
+#include <errno.h>
+#ifdef HAVE_LINUX_FUTEX_H
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <time.h>
+#endif
 
 #include <X11/Xdefs.h>
 #include <X11/Xatom.h>
@@ -133,6 +138,7 @@ static struct Parameter params[] = {
     {"PalmMinWidth",          PT_INT,    0, 15,    SYNAPTICS_PROP_PALM_DIMENSIONS,	32,	0},
     {"PalmMinZ",              PT_INT,    0, 255,   SYNAPTICS_PROP_PALM_DIMENSIONS,	32,	1},
     {"CoastingSpeed",         PT_DOUBLE, 0, 20,    SYNAPTICS_PROP_COASTING_SPEED,	0 /* float*/,	0},
+    {"CoastingFriction",      PT_DOUBLE, 0, 255,   SYNAPTICS_PROP_COASTING_FRICTION,	0 /* float*/,	0},
     {"PressureMotionMinZ",    PT_INT,    1, 255,   SYNAPTICS_PROP_PRESSURE_MOTION,	32,	0},
     {"PressureMotionMaxZ",    PT_INT,    1, 255,   SYNAPTICS_PROP_PRESSURE_MOTION,	32,	1},
     {"PressureMotionMinFactor", PT_DOUBLE, 0, 10.0,SYNAPTICS_PROP_PRESSURE_MOTION_FACTOR,	0 /*float*/,	0},
@@ -143,6 +149,8 @@ static struct Parameter params[] = {
     {"AreaRightEdge",         PT_INT,    0, 10000, SYNAPTICS_PROP_AREA,	32,	1},
     {"AreaTopEdge",           PT_INT,    0, 10000, SYNAPTICS_PROP_AREA,	32,	2},
     {"AreaBottomEdge",        PT_INT,    0, 10000, SYNAPTICS_PROP_AREA,	32,	3},
+    {"SmoothScrolling",       PT_BOOL,   0, 1,     SYNAPTICS_PROP_SMOOTH_SCROLLING,	8,	0},
+    {"VelocitySamples",       PT_INT,    2, 16,    SYNAPTICS_PROP_VELOCITY_SAMPLES,	32,	0},
     { NULL, 0, 0, 0, 0 }
 };
 
@@ -183,7 +191,7 @@ parse_cmd(char* cmd, struct Parameter** par)
 }
 
 static int
-is_equal(SynapticsSHM *s1, SynapticsSHM *s2)
+is_equal(SynapticsSHMState *s1, SynapticsSHMState *s2)
 {
     int i;
 
@@ -211,27 +219,99 @@ is_equal(SynapticsSHM *s1, SynapticsSHM *s2)
     return 1;
 }
 
-static double
-get_time(void)
+static int shm_writable;		    /* Shared memory attached read-write */
+
+/*
+ * Copy state n from the ring in shared memory. Returns 0 if the state has
+ * already been overwritten, see synaptics.h.
+ */
+static int
+shm_read_state(SynapticsSHM *synshm, unsigned int n, SynapticsSHMState *out)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1000000.0;
+    SynapticsSHMState *s = &synshm->ring[n & (SYNSHM_RING_SIZE - 1)];
+    unsigned int seq1, seq2;
+
+    seq1 = s->seq;
+    SYNSHM_BARRIER();
+    *out = *s;
+    SYNSHM_BARRIER();
+    seq2 = s->seq;
+
+    return seq1 == 2 * n + 2 && seq2 == 2 * n + 2;
+}
+
+/*
+ * Wait until the driver has written more than end states. Without futex
+ * support, poll every delay ms. A read-only reader can't set waiting; the
+ * driver only notices it through the attach count, so it doesn't sleep
+ * longer than delay ms at a time.
+ */
+static void
+shm_wait(SynapticsSHM *synshm, unsigned int end, int delay)
+{
+#ifdef HAVE_LINUX_FUTEX_H
+    struct timespec ts;
+
+    ts.tv_sec = delay / 1000;
+    ts.tv_nsec = (delay % 1000) * 1000000L;
+    while (synshm->write_index == end) {
+	if (shm_writable)
+	    synshm->waiting = 1;
+	if (syscall(SYS_futex, &synshm->write_index, FUTEX_WAIT, end,
+		    shm_writable ? NULL : &ts, NULL, 0) == -1) {
+	    if (errno == ETIMEDOUT)
+		return;
+	    if (errno != EAGAIN && errno != EINTR) {
+		perror("futex");
+		break;
+	    }
+	}
+    }
+    if (synshm->write_index != end)
+	return;
+#endif
+    usleep(delay * 1000);
 }
 
 static void
 shm_monitor(SynapticsSHM *synshm, int delay)
 {
     int header = 0;
-    SynapticsSHM old;
-    double t0 = get_time();
+    SynapticsSHMState old, cur;
+    unsigned int next, end, lost = 0;
+    unsigned int t0 = 0;
 
-    memset(&old, 0, sizeof(SynapticsSHM));
+    memset(&old, 0, sizeof(old));
     old.x = -1;				    /* Force first equality test to fail */
 
+    /* Start with the most recent state */
+    next = synshm->write_index;
+    if (next > 0)
+	next--;
+
     while (1) {
-	SynapticsSHM cur = *synshm;
-	if (!is_equal(&old, &cur)) {
+	end = synshm->write_index;
+	SYNSHM_BARRIER();
+
+	if (end - next > SYNSHM_RING_SIZE) {
+	    lost += end - next - SYNSHM_RING_SIZE;
+	    next = end - SYNSHM_RING_SIZE;
+	}
+
+	for (; next != end; next++) {
+	    if (!shm_read_state(synshm, next, &cur)) {
+		lost++;
+		continue;
+	    }
+	    if (lost) {
+		printf("# %u states lost\n", lost);
+		lost = 0;
+	    }
+	    if (is_equal(&old, &cur))
+		continue;
+
+	    if (old.x == -1)
+		t0 = cur.millis;
 	    if (!header) {
 		printf("%8s  %4s %4s %3s %s %2s %2s %s %s %s %s  %8s  "
 		       "%2s %2s %2s %3s %3s\n",
@@ -242,44 +322,111 @@ shm_monitor(SynapticsSHM *synshm, int delay)
 	    header--;
 	    printf("%8.3f  %4d %4d %3d %d %2d %2d %d %d %d %d  %d%d%d%d%d%d%d%d  "
 		   "%2d %2d %2d %3d %3d\n",
-		   get_time() - t0,
+		   (cur.millis - t0) / 1000.0,
 		   cur.x, cur.y, cur.z, cur.numFingers, cur.fingerWidth,
 		   cur.left, cur.right, cur.up, cur.down, cur.middle,
 		   cur.multi[0], cur.multi[1], cur.multi[2], cur.multi[3],
 		   cur.multi[4], cur.multi[5], cur.multi[6], cur.multi[7],
 		   cur.guest_left, cur.guest_mid, cur.guest_right,
 		   cur.guest_dx, cur.guest_dy);
-	    fflush(stdout);
 	    old = cur;
 	}
-	usleep(delay * 1000);
+	fflush(stdout);
+	shm_wait(synshm, end, delay);
     }
 }
 
+/*
+ * Look up the shared memory key of the named device in the index, or of
+ * the only device if name is NULL. Returns -1 on error.
+ */
+static key_t
+shm_find_device(const char *name)
+{
+    SynapticsSHMIndex *index;
+    SynapticsSHMIndexEntry *e;
+    key_t key = -1;
+    int shmid, i, found = 0;
+
+    if ((shmid = shmget(SHM_SYNAPTICS, sizeof(SynapticsSHMIndex), 0)) == -1) {
+	if ((shmid = shmget(SHM_SYNAPTICS, 0, 0)) == -1)
+	    fprintf(stderr, "Can't access shared memory area. SHMConfig disabled?\n");
+	else
+	    fprintf(stderr, "Incorrect size of shared memory area. Incompatible driver version?\n");
+	return -1;
+    }
+    if ((index = shmat(shmid, NULL, SHM_RDONLY)) == (void *)-1) {
+	perror("shmat");
+	return -1;
+    }
+
+    for (i = 0; i < SYNSHM_INDEX_SIZE; i++) {
+	e = &index->devices[i];
+	if (!e->key || (name && strncmp(e->name, name, SYNSHM_NAME_LEN)))
+	    continue;
+	key = e->key;
+	found++;
+    }
+
+    if (found == 0) {
+	if (name)
+	    fprintf(stderr, "Touchpad '%s' not found in shared memory.\n", name);
+	else
+	    fprintf(stderr, "No touchpad found in shared memory. SHMConfig disabled?\n");
+	key = -1;
+    } else if (found > 1) {
+	fprintf(stderr, "Several touchpads found, select one with -d:\n");
+	for (i = 0; i < SYNSHM_INDEX_SIZE; i++) {
+	    e = &index->devices[i];
+	    if (e->key)
+		fprintf(stderr, "    %.*s\n", SYNSHM_NAME_LEN, e->name);
+	}
+	key = -1;
+    }
+
+    shmdt(index);
+    return key;
+}
+
 /** Init and return SHM area or NULL on error */
 static  SynapticsSHM*
-shm_init()
+shm_init(const char *name)
 {
     SynapticsSHM *synshm = NULL;
     int shmid = 0;
+    key_t key;
 
-    if ((shmid = shmget(SHM_SYNAPTICS, sizeof(SynapticsSHM), 0)) == -1) {
-	if ((shmid = shmget(SHM_SYNAPTICS, 0, 0)) == -1)
+    if ((key = shm_find_device(name)) == -1)
+	return NULL;
+
+    if ((shmid = shmget(key, sizeof(SynapticsSHM), 0)) == -1) {
+	if ((shmid = shmget(key, 0, 0)) == -1)
 	    fprintf(stderr, "Can't access shared memory area. SHMConfig disabled?\n");
 	else
 	    fprintf(stderr, "Incorrect size of shared memory area. Incompatible driver version?\n");
-    } else if ((synshm = (SynapticsSHM*) shmat(shmid, NULL, SHM_RDONLY)) == NULL)
-	perror("shmat");
+	return NULL;
+    }
 
+    /* Writing is only needed to ask the driver for wakeups */
+    synshm = (SynapticsSHM*) shmat(shmid, NULL, 0);
+    if (synshm != (SynapticsSHM*) -1) {
+	shm_writable = 1;
+	return synshm;
+    }
+    synshm = (SynapticsSHM*) shmat(shmid, NULL, SHM_RDONLY);
+    if (synshm == (SynapticsSHM*) -1) {
+	perror("shmat");
+	return NULL;
+    }
     return synshm;
 }
 
 static void
-shm_process_commands(int do_monitor, int delay)
+shm_process_commands(const char *name, int do_monitor, int delay)
 {
     SynapticsSHM *synshm = NULL;
 
-    synshm = shm_init();
+    synshm = shm_init(name);
     if (!synshm)
         return;
 
@@ -343,7 +490,7 @@ unwind:
 }
 
 static XDevice *
-dp_get_device(Display *dpy)
+dp_get_device(Display *dpy, const char *name)
 {
     XDevice* dev		= NULL;
     XDeviceInfo *info		= NULL;
@@ -359,6 +506,8 @@ dp_get_device(Display *dpy)
     info = XListInputDevices(dpy, &ndevices);
 
     while(ndevices--) {
+	if (name && strcmp(info[ndevices].name, name))
+	    continue;
 	if (info[ndevices].type == touchpad_type) {
 	    dev = XOpenDevice(dpy, info[ndevices].id);
 	    if (!dev) {
@@ -397,7 +546,9 @@ dp_get_device(Display *dpy)
 unwind:
     XFree(properties);
     XFreeDeviceList(info);
-    if (!dev)
+    if (!dev && name)
+        fprintf(stderr, "Unable to find synaptics device '%s'.\n", name);
+    else if (!dev)
         fprintf(stderr, "Unable to find a synaptics device.\n");
     else if (error && dev)
     {
@@ -408,12 +559,10 @@ unwind:
 }
 
 static void
-dp_set_variables(Display *dpy, XDevice* dev, int argc, char *argv[], int first_cmd)
+dp_set_variable(Display *dpy, XDevice* dev, Atom float_type,
+		struct Parameter *par, double val)
 {
-    int i;
-    double val;
-    struct Parameter *par;
-    Atom prop, type, float_type;
+    Atom prop, type;
     int format;
     unsigned char* data;
     unsigned long nitems, bytes_after;
@@ -422,64 +571,157 @@ dp_set_variables(Display *dpy, XDevice* dev, int argc, char *argv[], int first_c
     long *n;
     char *b;
 
-    float_type = XInternAtom(dpy, XATOM_FLOAT, True);
-    if (!float_type)
-	fprintf(stderr, "Float properties not available.\n");
-
-    for (i = first_cmd; i < argc; i++) {
-	val = parse_cmd(argv[i], &par);
-	if (!par)
-	    continue;
-
-	prop = XInternAtom(dpy, par->prop_name, True);
-	if (!prop)
-	{
-	    fprintf(stderr, "Property for '%s' not available. Skipping.\n",
-		    par->name);
-	    continue;
+    prop = XInternAtom(dpy, par->prop_name, True);
+    if (!prop)
+    {
+	fprintf(stderr, "Property for '%s' not available. Skipping.\n",
+		par->name);
+	return;
 
-	}
+    }
 
-	XGetDeviceProperty(dpy, dev, prop, 0, 1000, False, AnyPropertyType,
-				&type, &format, &nitems, &bytes_after, &data);
+    XGetDeviceProperty(dpy, dev, prop, 0, 1000, False, AnyPropertyType,
+			    &type, &format, &nitems, &bytes_after, &data);
 
-	switch(par->prop_format)
-	{
-	    case 8:
-		if (format != par->prop_format || type != XA_INTEGER) {
-		    fprintf(stderr, "   %-23s = format mismatch (%d)\n",
-			    par->name, format);
-		    break;
-		}
-		b = (char*)data;
-		b[par->prop_offset] = rint(val);
+    switch(par->prop_format)
+    {
+	case 8:
+	    if (format != par->prop_format || type != XA_INTEGER) {
+		fprintf(stderr, "   %-23s = format mismatch (%d)\n",
+			par->name, format);
 		break;
-	    case 32:
-		if (format != par->prop_format || type != XA_INTEGER) {
-		    fprintf(stderr, "   %-23s = format mismatch (%d)\n",
-			    par->name, format);
-		    break;
-		}
-		n = (long*)data;
-		n[par->prop_offset] = rint(val);
+	    }
+	    b = (char*)data;
+	    b[par->prop_offset] = rint(val);
+	    break;
+	case 32:
+	    if (format != par->prop_format || type != XA_INTEGER) {
+		fprintf(stderr, "   %-23s = format mismatch (%d)\n",
+			par->name, format);
 		break;
-	    case 0: /* float */
-		if (!float_type)
-		    continue;
-		if (format != 32 || type != float_type) {
-		    fprintf(stderr, "   %-23s = format mismatch (%d)\n",
-			    par->name, format);
-		    break;
-		}
-		f = (union flong*)data;
-		f[par->prop_offset].f = val;
+	    }
+	    n = (long*)data;
+	    n[par->prop_offset] = rint(val);
+	    break;
+	case 0: /* float */
+	    if (!float_type)
+		return;
+	    if (format != 32 || type != float_type) {
+		fprintf(stderr, "   %-23s = format mismatch (%d)\n",
+			par->name, format);
 		break;
+	    }
+	    f = (union flong*)data;
+	    f[par->prop_offset].f = val;
+	    break;
+    }
+
+    XChangeDeviceProperty(dpy, dev, prop, type, format,
+			    PropModeReplace, data, nitems);
+    XFlush(dpy);
+}
+
+/*
+ * Send all changes in a single "Synaptics Parameter Set" request, so the
+ * driver applies them together. Returns 0 if the driver doesn't support
+ * it and the parameters have to be set one by one.
+ */
+static int
+dp_set_parameter_set(Display *dpy, XDevice* dev, int count,
+		     struct Parameter **pars, double *vals)
+{
+    char **names;
+    Atom *atoms;
+    union flong *changes;
+    int i, n = 0, supported;
+
+    names = malloc((count + 1) * sizeof(char*));
+    atoms = malloc((count + 1) * sizeof(Atom));
+    changes = malloc(3 * count * sizeof(union flong));
+    if (!names || !atoms || !changes) {
+	free(names);
+	free(atoms);
+	free(changes);
+	return 0;
+    }
+
+    /* look up all atoms in one round trip */
+    names[0] = SYNAPTICS_PROP_PARAMETER_SET;
+    for (i = 0; i < count; i++)
+	names[i + 1] = pars[i]->prop_name;
+    XInternAtoms(dpy, names, count + 1, True, atoms);
+
+    supported = (atoms[0] != None);
+    if (supported) {
+	for (i = 0; i < count; i++) {
+	    if (!atoms[i + 1]) {
+		fprintf(stderr, "Property for '%s' not available. Skipping.\n",
+			pars[i]->name);
+		continue;
+	    }
+	    changes[n].l = atoms[i + 1];
+	    changes[n + 1].l = pars[i]->prop_offset;
+	    changes[n + 2].l = 0;
+	    if (pars[i]->prop_format == 0)
+		changes[n + 2].f = vals[i];
+	    else
+		changes[n + 2].l = rint(vals[i]);
+	    n += 3;
 	}
 
-	XChangeDeviceProperty(dpy, dev, prop, type, format,
-				PropModeReplace, data, nitems);
-	XFlush(dpy);
+	if (n > 0) {
+	    XChangeDeviceProperty(dpy, dev, atoms[0], XA_INTEGER, 32,
+				  PropModeReplace, (unsigned char*)changes, n);
+	    XFlush(dpy);
+	}
     }
+
+    free(names);
+    free(atoms);
+    free(changes);
+    return supported;
+}
+
+static void
+dp_set_variables(Display *dpy, XDevice* dev, int argc, char *argv[], int first_cmd)
+{
+    int i, count = 0;
+    double val;
+    struct Parameter *par;
+    struct Parameter **pars;
+    double *vals;
+    Atom float_type;
+
+    if (first_cmd >= argc)
+	return;
+
+    pars = malloc((argc - first_cmd) * sizeof(struct Parameter*));
+    vals = malloc((argc - first_cmd) * sizeof(double));
+    if (!pars || !vals) {
+	fprintf(stderr, "Out of memory.\n");
+	exit(1);
+    }
+
+    for (i = first_cmd; i < argc; i++) {
+	val = parse_cmd(argv[i], &par);
+	if (!par)
+	    continue;
+	pars[count] = par;
+	vals[count] = val;
+	count++;
+    }
+
+    if (count > 0 && !dp_set_parameter_set(dpy, dev, count, pars, vals)) {
+	float_type = XInternAtom(dpy, XATOM_FLOAT, True);
+	if (!float_type)
+	    fprintf(stderr, "Float properties not available.\n");
+
+	for (i = 0; i < count; i++)
+	    dp_set_variable(dpy, dev, float_type, pars[i], vals[i]);
+    }
+
+    free(pars);
+    free(vals);
 }
 
 /* FIXME: horribly inefficient. */
@@ -559,9 +801,11 @@ dp_show_settings(Display *dpy, XDevice *dev)
 static void
 usage(void)
 {
-    fprintf(stderr, "Usage: synclient [-s] [-m interval] [-h] [-l] [-V] [-?] [var1=value1 [var2=value2] ...]\n");
+    fprintf(stderr, "Usage: synclient [-s] [-d device] [-m interval] [-h] [-l] [-V] [-?] [var1=value1 [var2=value2] ...]\n");
+    fprintf(stderr, "  -d use the touchpad with the given input device name\n");
     fprintf(stderr, "  -m monitor changes to the touchpad state (implies -s)\n"
-	    "     interval specifies how often (in ms) to poll the touchpad state\n");
+	    "     interval specifies how often (in ms) to poll the touchpad state\n"
+	    "     if the driver can't send wakeups\n");
     fprintf(stderr, "  -l List current user settings\n");
     fprintf(stderr, "  -V Print synclient version string and exit\n");
     fprintf(stderr, "  -? Show this help message\n");
@@ -577,6 +821,7 @@ main(int argc, char *argv[])
     int do_monitor = 0;
     int dump_settings = 0;
     int first_cmd;
+    char *device_name = NULL;
 
     Display *dpy;
     XDevice *dev;
@@ -585,8 +830,11 @@ main(int argc, char *argv[])
         dump_settings = 1;
 
     /* Parse command line parameters */
-    while ((c = getopt(argc, argv, "sm:hlV")) != -1) {
+    while ((c = getopt(argc, argv, "sd:m:hlV")) != -1) {
 	switch (c) {
+	case 'd':
+	    device_name = optarg;
+	    break;
 	case 'm':
 	    do_monitor = 1;
 	    if ((delay = atoi(optarg)) < 0)
@@ -609,10 +857,10 @@ main(int argc, char *argv[])
 
     /* Connect to the shared memory area */
     if (do_monitor)
-        shm_process_commands(do_monitor, delay);
+        shm_process_commands(device_name, do_monitor, delay);
 
     dpy = dp_init();
-    if (!dpy || !(dev = dp_get_device(dpy)))
+    if (!dpy || !(dev = dp_get_device(dpy, device_name)))
         return 1;
 
     dp_set_variables(dpy, dev, argc, argv, first_cmd);